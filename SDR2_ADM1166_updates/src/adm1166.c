@@ -0,0 +1,457 @@
+/*
+ * Copyright (C) 2015-2016 Analog Devices, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/i2c-dev.h>
+#include <linux/i2c.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+
+#include "adm1166.h"
+#include "probes.h"
+
+static const char * const adm1166_adc_names[ADM1166_ADC_CHANNELS] = {
+	"VP1", "VP2", "VP3", "VP4", "VH", "VX1", "VX2", "VX3", "VX4", "VX5",
+	"AUX1", "AUX2", "TEMP",
+};
+
+int adm1166_parse_target(const char *spec, unsigned int *bus,
+	unsigned int *addr)
+{
+	char *end;
+
+	*bus = strtoul(spec, &end, 0);
+	if (end == spec)
+		return -1;
+
+	if (*end == '\0') {
+		*addr = ADM1166_DEFAULT_ADDR;
+		return 0;
+	}
+	if (*end != ':')
+		return -1;
+
+	spec = end + 1;
+	*addr = strtoul(spec, &end, 0);
+	if (end == spec || *end != '\0' || *addr > 0x7f)
+		return -1;
+
+	return 0;
+}
+
+static int adm1166_i2c_xfer(struct adm1166 *dev, struct i2c_msg *msgs,
+	unsigned int nmsgs)
+{
+	struct i2c_rdwr_ioctl_data xfer;
+	unsigned int i;
+	int ret;
+
+	for (i = 0; i < nmsgs; i++)
+		msgs[i].addr = dev->addr;
+
+	xfer.msgs = msgs;
+	xfer.nmsgs = nmsgs;
+
+	ret = ioctl(dev->fd, I2C_RDWR, &xfer);
+	if (ret < 0)
+		return -errno;
+	if (ret != (int)nmsgs)
+		return -EIO;
+
+	return 0;
+}
+
+static void adm1166_i2c_close(struct adm1166 *dev)
+{
+	close(dev->fd);
+}
+
+static const struct adm1166_ops adm1166_i2c_ops = {
+	.xfer = adm1166_i2c_xfer,
+	.close = adm1166_i2c_close,
+};
+
+int adm1166_open(struct adm1166 *dev, unsigned int bus, unsigned int addr)
+{
+	char path[32];
+
+	snprintf(path, sizeof(path), "/dev/i2c-%u", bus);
+
+	dev->fd = open(path, O_RDWR);
+	if (dev->fd < 0) {
+		fprintf(stderr, "Failed to open %s: %d\n", path, errno);
+		return -errno;
+	}
+
+	dev->ops = &adm1166_i2c_ops;
+	dev->priv = NULL;
+	dev->lock = NULL;
+	dev->bus = bus;
+	dev->addr = addr;
+
+	return 0;
+}
+
+/*
+ * Targets are either "<bus>[:<addr>]" for a device behind /dev/i2c-<bus>
+ * or "sim[:<ihex-file>]" for a simulated device loaded with an image.
+ */
+int adm1166_open_target(struct adm1166 *dev, const char *spec)
+{
+	unsigned int bus, addr;
+
+	if (strcmp(spec, "sim") == 0)
+		return adm1166_sim_open(dev, NULL);
+	if (strncmp(spec, "sim:", 4) == 0)
+		return adm1166_sim_open(dev, spec + 4);
+
+	if (adm1166_parse_target(spec, &bus, &addr) < 0) {
+		fprintf(stderr, "Invalid target \"%s\"\n", spec);
+		return -EINVAL;
+	}
+
+	return adm1166_open(dev, bus, addr);
+}
+
+/* Anything that is not a simulator spec or a readable file is a target */
+int adm1166_source_is_image(const char *source)
+{
+	if (strcmp(source, "sim") == 0 || strncmp(source, "sim:", 4) == 0)
+		return 0;
+
+	return access(source, R_OK) == 0;
+}
+
+void adm1166_close(struct adm1166 *dev)
+{
+	if (dev->ops)
+		dev->ops->close(dev);
+	dev->ops = NULL;
+	dev->fd = -1;
+}
+
+static void dev_lock(struct adm1166 *dev)
+{
+	if (dev->lock)
+		pthread_mutex_lock(dev->lock);
+}
+
+static void dev_unlock(struct adm1166 *dev)
+{
+	if (dev->lock)
+		pthread_mutex_unlock(dev->lock);
+}
+
+/* With the device lock held */
+static int dev_xfer(struct adm1166 *dev, struct i2c_msg *msgs,
+	unsigned int nmsgs)
+{
+	int ret;
+
+	PROBE4(xfer__entry, dev->bus, dev->addr, nmsgs, msgs);
+	ret = dev->ops->xfer(dev, msgs, nmsgs);
+	PROBE3(xfer__return, dev->bus, dev->addr, ret);
+
+	return ret;
+}
+
+int adm1166_xfer(struct adm1166 *dev, struct i2c_msg *msgs,
+	unsigned int nmsgs)
+{
+	int ret;
+
+	dev_lock(dev);
+	ret = dev_xfer(dev, msgs, nmsgs);
+	dev_unlock(dev);
+
+	return ret;
+}
+
+int adm1166_reg_read(struct adm1166 *dev, unsigned int reg,
+	unsigned char *val)
+{
+	unsigned char buf[1];
+	struct i2c_msg msg[2];
+	int ret;
+
+	buf[0] = reg;
+
+	msg[0].flags = 0;
+	msg[0].len = 1;
+	msg[0].buf = buf;
+	msg[1].flags = I2C_M_RD;
+	msg[1].len = 1;
+	msg[1].buf = val;
+
+	ret = adm1166_xfer(dev, msg, 2);
+	if (ret < 0)
+		fprintf(stderr, "%s failed: %d, %x\n", __func__, -ret, reg);
+
+	return ret;
+}
+
+int adm1166_reg_write(struct adm1166 *dev, unsigned int reg,
+	unsigned char val)
+{
+	unsigned char buf[2];
+	struct i2c_msg msg;
+	int ret;
+
+	buf[0] = reg;
+	buf[1] = val;
+
+	msg.flags = 0;
+	msg.len = 2;
+	msg.buf = buf;
+
+	ret = adm1166_xfer(dev, &msg, 1);
+	if (ret < 0)
+		fprintf(stderr, "%s failed: %d, %x\n", __func__, -ret, reg);
+
+	return ret;
+}
+
+int adm1166_regs_read(struct adm1166 *dev, unsigned int reg,
+	unsigned char *buf, unsigned int len)
+{
+	unsigned char cmd[1];
+	struct i2c_msg msg[2];
+	int ret;
+
+	/* The address pointer auto-increments, one transaction for all */
+	cmd[0] = reg;
+
+	msg[0].flags = 0;
+	msg[0].len = 1;
+	msg[0].buf = cmd;
+	msg[1].flags = I2C_M_RD;
+	msg[1].len = len;
+	msg[1].buf = buf;
+
+	ret = adm1166_xfer(dev, msg, 2);
+	if (ret < 0)
+		fprintf(stderr, "%s failed: %d, %x\n", __func__, -ret, reg);
+
+	return ret;
+}
+
+/* Reads one 32 byte EEPROM page with the 0xfd block read command */
+static int eeprom_read(struct adm1166 *dev, unsigned int addr,
+	unsigned char *buf)
+{
+	unsigned char cmd[2], rbuf[ADM1166_PAGE_SIZE + 1];
+	struct i2c_msg msg[2];
+	int ret;
+
+	cmd[0] = (addr >> 8) & 0xff;
+	cmd[1] = addr & 0xff;
+
+	msg[0].flags = 0;
+	msg[0].len = 2;
+	msg[0].buf = cmd;
+	ret = dev_xfer(dev, msg, 1);
+	if (ret < 0) {
+		fprintf(stderr, "%s step 1 failed: %d, %x\n", __func__, -ret, addr);
+		return ret;
+	}
+
+	cmd[0] = ADM1166_CMD_BLOCK_READ;
+
+	msg[0].len = 1;
+	msg[1].flags = I2C_M_RD;
+	msg[1].len = sizeof(rbuf);
+	msg[1].buf = rbuf;
+	ret = dev_xfer(dev, msg, 2);
+	if (ret < 0) {
+		fprintf(stderr, "%s step 2 failed: %d, %x\n", __func__, -ret, addr);
+		return ret;
+	}
+
+	if (rbuf[0] != ADM1166_PAGE_SIZE) {
+		fprintf(stderr, "%s step 3 failed: %d, %x\n", __func__, rbuf[0], addr);
+		return -EIO;
+	}
+
+	memcpy(buf, rbuf + 1, ADM1166_PAGE_SIZE);
+
+	return 0;
+}
+
+int adm1166_eeprom_read(struct adm1166 *dev, unsigned int addr,
+	unsigned char *buf)
+{
+	int ret;
+
+	PROBE3(page__read__entry, dev->bus, dev->addr, addr);
+	dev_lock(dev);
+	ret = eeprom_read(dev, addr, buf);
+	dev_unlock(dev);
+	PROBE4(page__read__return, dev->bus, dev->addr, addr, ret);
+
+	return ret;
+}
+
+/* Sets the address pointer and erases the 32 byte page it points into */
+static int eeprom_erase(struct adm1166 *dev, unsigned int addr)
+{
+	unsigned char buf[2];
+	struct i2c_msg msg;
+	int ret;
+
+	buf[0] = (addr >> 8) & 0xff;
+	buf[1] = addr & 0xff;
+
+	msg.flags = 0;
+	msg.len = 2;
+	msg.buf = buf;
+	ret = dev_xfer(dev, &msg, 1);
+	if (ret < 0) {
+		fprintf(stderr, "%s step 1 failed: %d, %x\n", __func__, -ret, addr);
+		return ret;
+	}
+
+	buf[0] = ADM1166_CMD_ERASE;
+
+	msg.len = 1;
+	ret = dev_xfer(dev, &msg, 1);
+	if (ret < 0) {
+		fprintf(stderr, "%s step 2 failed: %d, %x\n", __func__, -ret, addr);
+		return ret;
+	}
+
+	return 0;
+}
+
+int adm1166_eeprom_erase(struct adm1166 *dev, unsigned int addr)
+{
+	int ret;
+
+	PROBE3(page__erase__entry, dev->bus, dev->addr, addr);
+	dev_lock(dev);
+	ret = eeprom_erase(dev, addr);
+	dev_unlock(dev);
+	PROBE4(page__erase__return, dev->bus, dev->addr, addr, ret);
+
+	return ret;
+}
+
+/* Writes one erased page with the 0xfc block write command */
+static int eeprom_write(struct adm1166 *dev, unsigned int addr,
+	const unsigned char *buf)
+{
+	unsigned char wbuf[ADM1166_PAGE_SIZE + 2];
+	struct i2c_msg msg;
+	int ret;
+
+	wbuf[0] = (addr >> 8) & 0xff;
+	wbuf[1] = addr & 0xff;
+
+	msg.flags = 0;
+	msg.len = 2;
+	msg.buf = wbuf;
+	ret = dev_xfer(dev, &msg, 1);
+	if (ret < 0) {
+		fprintf(stderr, "%s step 1 failed: %d, %x\n", __func__, -ret, addr);
+		return ret;
+	}
+
+	wbuf[0] = ADM1166_CMD_BLOCK_WRITE;
+	wbuf[1] = ADM1166_PAGE_SIZE;
+	memcpy(wbuf + 2, buf, ADM1166_PAGE_SIZE);
+
+	msg.len = sizeof(wbuf);
+	ret = dev_xfer(dev, &msg, 1);
+	if (ret < 0) {
+		fprintf(stderr, "%s step 2 failed: %d, %x\n", __func__, -ret, addr);
+		return ret;
+	}
+
+	return 0;
+}
+
+int adm1166_eeprom_write(struct adm1166 *dev, unsigned int addr,
+	const unsigned char *buf)
+{
+	int ret;
+
+	PROBE3(page__write__entry, dev->bus, dev->addr, addr);
+	dev_lock(dev);
+	ret = eeprom_write(dev, addr, buf);
+	dev_unlock(dev);
+	PROBE4(page__write__return, dev->bus, dev->addr, addr, ret);
+
+	return ret;
+}
+
+/* Reloads all configuration registers from the EEPROM, as at power-up */
+int adm1166_eeprom_download(struct adm1166 *dev)
+{
+	unsigned char buf[1];
+	struct i2c_msg msg;
+	int ret;
+
+	buf[0] = ADM1166_CMD_DOWNLOAD;
+
+	msg.flags = 0;
+	msg.len = 1;
+	msg.buf = buf;
+	ret = adm1166_xfer(dev, &msg, 1);
+	if (ret < 0)
+		fprintf(stderr, "%s failed: %d\n", __func__, -ret);
+
+	return ret;
+}
+
+int adm1166_adc_read(struct adm1166 *dev, unsigned int ch,
+	unsigned int *code)
+{
+	unsigned char buf[2];
+	int ret;
+
+	if (ch >= ADM1166_ADC_CHANNELS)
+		return -EINVAL;
+
+	ret = adm1166_regs_read(dev, ADM1166_REG_ADC(ch), buf, 2);
+	if (ret < 0)
+		return ret;
+
+	*code = (buf[0] << 4) | (buf[1] & 0x0f);
+
+	return 0;
+}
+
+int adm1166_adc_channel_by_name(const char *name)
+{
+	unsigned int i;
+
+	for (i = 0; i < ADM1166_ADC_CHANNELS; i++) {
+		if (strcasecmp(name, adm1166_adc_names[i]) == 0)
+			return i;
+	}
+
+	return -1;
+}
+
+const char *adm1166_adc_channel_name(unsigned int ch)
+{
+	if (ch >= ADM1166_ADC_CHANNELS)
+		return "?";
+	return adm1166_adc_names[ch];
+}
@@ -0,0 +1,411 @@
+/*
+ * Copyright (C) 2015-2016 Analog Devices, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * */
+
+#ifndef __ADM1166_H__
+#define __ADM1166_H__
+
+#include <pthread.h>
+#include <stdio.h>
+
+#define ADM1166_DEFAULT_BUS	0
+#define ADM1166_DEFAULT_ADDR	0x34
+
+#define ADM1166_NUM_DACS	6
+#define ADM1166_DAC_MIDCODE	0x7f
+
+#define ADM1166_REG_DACCTRL(n)	(0x50 + (n) - 1)
+#define ADM1166_REG_DAC(n)	(0x58 + (n) - 1)
+#define ADM1166_REG_DPLIM(n)	(0x60 + (n) - 1)
+#define ADM1166_REG_DNLIM(n)	(0x68 + (n) - 1)
+#define ADM1166_REG_RRSEL1	0x80
+#define ADM1166_REG_RRSEL2	0x81
+#define ADM1166_REG_RRCTRL	0x82
+#define ADM1166_REG_TSCTRL	0x83
+#define ADM1166_REG_UPDCFG	0x90
+#define ADM1166_REG_SECTRL	0x93
+#define ADM1166_REG_PDOSTAT1	0xe6
+#define ADM1166_REG_PDOSTAT2	0xe7
+#define ADM1166_REG_SESTATE	0xe8
+
+#define ADM1166_CMD_DOWNLOAD	0xd8
+#define ADM1166_CMD_BLOCK_WRITE	0xfc
+#define ADM1166_CMD_BLOCK_READ	0xfd
+#define ADM1166_CMD_ERASE	0xfe
+
+#define ADM1166_DACCTRL_ENABLE	0x01
+#define ADM1166_RRCTRL_GO	0x01
+#define ADM1166_RRCTRL_AVG	0x02
+#define ADM1166_RRCTRL_ENABLE	0x04
+#define ADM1166_RRCTRL_STOPWRITE	0x08
+#define ADM1166_TSCTRL_ENABLE	0x01
+#define ADM1166_UPDCFG_EEPROM_EN	0x04
+#define ADM1166_SECTRL_HALT	0x01
+
+/* Supply fault detectors: VP1-VP4, VH and VX1-VX5, 8 registers each */
+#define ADM1166_NUM_SFDS	10
+#define ADM1166_REG_OVTH(n)	(0x00 + 8 * (n))
+#define ADM1166_REG_UVTH(n)	(0x02 + 8 * (n))
+#define ADM1166_REG_SFDCFG(n)	(0x04 + 8 * (n))
+
+/*
+ * ADC readback channels, in the same order as the ADCxxLIM registers
+ * (0x70 - 0x7c).  Each result is 12 bits wide: bits 11:4 in the first
+ * readback register, bits 3:0 in the low nibble of the second one.
+ */
+enum adm1166_adc_channel {
+	ADM1166_ADC_VP1,
+	ADM1166_ADC_VP2,
+	ADM1166_ADC_VP3,
+	ADM1166_ADC_VP4,
+	ADM1166_ADC_VH,
+	ADM1166_ADC_VX1,
+	ADM1166_ADC_VX2,
+	ADM1166_ADC_VX3,
+	ADM1166_ADC_VX4,
+	ADM1166_ADC_VX5,
+	ADM1166_ADC_AUX1,
+	ADM1166_ADC_AUX2,
+	ADM1166_ADC_TEMP,
+	ADM1166_ADC_CHANNELS,
+};
+
+#define ADM1166_REG_ADC(ch)	(0xa0 + 2 * (ch))
+
+/* Temperature channel: 0.25 C per LSB, 0 C at midscale */
+#define ADM1166_TEMP_ZERO_CODE	0x800
+#define ADM1166_TEMP_LSB_MC	250
+#define ADM1166_TEMP_MC(code)	(((int)(code) - ADM1166_TEMP_ZERO_CODE) * \
+				 ADM1166_TEMP_LSB_MC)
+
+#define ADM1166_EEPROM_BASE	0xf800
+#define ADM1166_EEPROM_SIZE	0x400
+#define ADM1166_PAGE_SIZE	0x20
+#define ADM1166_SE_BASE		0xfa00
+#define ADM1166_SE_STATES	64
+
+/* Configuration registers 0x00 - 0x9c, mirrored at 0xf800 in the EEPROM */
+#define ADM1166_NUM_REGS	0x9d
+
+/* Stored checksums, device ID and configuration version */
+#define ADM1166_EE_CFG_CSUM	0xf888
+#define ADM1166_EE_USER_CSUM	0xf88a
+#define ADM1166_EE_SE_CSUM	0xf88c
+#define ADM1166_EE_DEVICE_ID	0xf88f
+#define ADM1166_EE_CFG_VERSION	0xf89d
+#define ADM1166_USER_BASE	0xf900
+
+#define ADM1166_REPORT_PLAIN	0x01
+
+struct i2c_msg;
+struct adm1166;
+struct proto_buf;
+
+struct adm1166_ops {
+	int (*xfer)(struct adm1166 *dev, struct i2c_msg *msgs,
+		unsigned int nmsgs);
+	void (*close)(struct adm1166 *dev);
+};
+
+/*
+ * Threads sharing a device set lock: every transaction, and the address
+ * setup and command of an EEPROM access together, hold it.
+ */
+struct adm1166 {
+	const struct adm1166_ops *ops;
+	void *priv;
+	int fd;
+	unsigned int bus;
+	unsigned int addr;
+	pthread_mutex_t *lock;
+};
+
+struct adm1166_image {
+	unsigned char data[ADM1166_EEPROM_SIZE];
+	unsigned char valid[ADM1166_EEPROM_SIZE / 8];
+};
+
+#define ADM1166_NUM_PAGES	(ADM1166_EEPROM_SIZE / ADM1166_PAGE_SIZE)
+
+/*
+ * Programming plan for a (possibly sparse) image: every page the image
+ * touches is read once into old and merged into image, pages lists the
+ * ones whose contents actually change.
+ */
+struct adm1166_plan {
+	struct adm1166_image image;
+	unsigned char old[ADM1166_EEPROM_SIZE];
+	unsigned int pages[ADM1166_NUM_PAGES];
+	unsigned int num_pages;
+};
+
+#define ADM1166_NUM_CSUMS	3
+
+/*
+ * Background EEPROM scrubber, adm1166_scrub_step() reads one page per
+ * call.  With a reference image the configuration and sequence engine
+ * pages it supplies are compared against it, without one every pass is
+ * checked against the stored checksums.  A checksum the stored value
+ * cannot be reproduced for is checked against the first pass instead.
+ */
+struct adm1166_scrub {
+	struct adm1166_image ref;
+	int use_ref;
+	unsigned char data[ADM1166_EEPROM_SIZE];
+	unsigned int pages[ADM1166_NUM_PAGES];
+	unsigned int num_pages;
+	unsigned int next;
+	unsigned long long passes;
+	unsigned long baseline[ADM1166_NUM_CSUMS];
+	unsigned int use_baseline;
+};
+
+/*
+ * One sequence engine state, 8 little endian bytes at 0xfa00 + 8 * n.
+ * Bits 9:0 drive PDO1-PDO10, bits 25:16 select the supply fault detectors
+ * watched by the monitor, bits 39:35 the sequence condition (0 = none) and
+ * bits 43:40,34:32 the timer (0 = no timeout).  The monitor, timeout and
+ * sequence next states are bits 49:44, 55:50 and 61:56.
+ */
+struct adm1166_se_state {
+	unsigned int pdo;
+	unsigned int monitor_mask;
+	unsigned int seq_sel;
+	unsigned int timer;
+	unsigned int next_seq;
+	unsigned int next_timeout;
+	unsigned int next_monitor;
+};
+
+struct adm1166_sample {
+	unsigned long long t_us;
+	unsigned int state;
+	unsigned int pdo;
+	unsigned int mask;
+	unsigned short adc[ADM1166_ADC_CHANNELS];
+};
+
+/*
+ * Readback round robin over the channels in mask, RRSEL1/RRSEL2 hold the
+ * channels left out.  Every channel takes ADM1166_RR_CONV_US, times
+ * ADM1166_RR_AVG with averaging, so fresh codes appear once per cycle_us.
+ * noise is the worst channel's standard deviation in codes without
+ * averaging, as measured by adm1166_readback_tune().
+ */
+#define ADM1166_RR_CONV_US	440
+#define ADM1166_RR_AVG		16
+
+struct adm1166_readback {
+	unsigned int mask;
+	int avg;
+	unsigned int cycle_us;
+	float noise;
+};
+
+/* A live register that no longer has its power-up value ee */
+struct adm1166_drift {
+	unsigned int reg;
+	unsigned int ee;
+	unsigned int live;
+};
+
+/* A sequence engine transition taken because of a supply fault */
+struct adm1166_event {
+	unsigned long long t_us;
+	unsigned int from;
+	unsigned int to;
+	unsigned int pdo;
+};
+
+/* Frame types of the telemetry push protocol */
+#define ADM1166_MSG_HELLO	1
+#define ADM1166_MSG_SAMPLES	2
+#define ADM1166_MSG_EVENT	3
+#define ADM1166_MSG_DROPPED	4
+#define ADM1166_MSG_SCRUB	5
+#define ADM1166_MSG_DRIFT	6
+
+#define ADM1166_PROTO_VERSION	1
+
+/*
+ * Agent calls, same framing.  A request starts with a varint ID, the
+ * reply echoes it followed by a zigzag status (0 or -errno) and the
+ * result.  Requests may be pipelined, replies come back in order.
+ */
+#define ADM1166_RPC_SNAPSHOT	16
+#define ADM1166_RPC_PLAN	17
+#define ADM1166_RPC_PROGRAM	18
+#define ADM1166_RPC_VERIFY	19
+#define ADM1166_RPC_TELEMETRY	20
+#define ADM1166_RPC_REPLY	31
+
+/* ADM1166_RPC_PROGRAM flags */
+#define ADM1166_RPC_NO_ACTIVATE	0x01
+
+/*
+ * Per board telemetry signature: steady state mean and noise of every
+ * channel, power-up ramp time (10% - 90%), temperature coefficient in
+ * codes per C and mean dwell time per sequence engine state.  When the
+ * capture has seen enough temperature swing, mean is normalized to 25 C
+ * and noise is what is left after removing the temperature dependence.
+ * Missing features are NaN.
+ */
+#define ADM1166_SIG_MEAN(ch)	(ch)
+#define ADM1166_SIG_NOISE(ch)	(ADM1166_ADC_CHANNELS + (ch))
+#define ADM1166_SIG_RAMP(ch)	(2 * ADM1166_ADC_CHANNELS + (ch))
+#define ADM1166_SIG_TEMPCO(ch)	(3 * ADM1166_ADC_CHANNELS + (ch))
+#define ADM1166_SIG_DWELL(n)	(4 * ADM1166_ADC_CHANNELS + (n))
+#define ADM1166_SIG_FEATURES	(4 * ADM1166_ADC_CHANNELS + ADM1166_SE_STATES)
+
+struct adm1166_signature {
+	float f[ADM1166_SIG_FEATURES];
+};
+
+/*
+ * Bus activity counted by the simulator, enough to work out the time on
+ * the wire for any clock rate afterwards.  cmd_bytes are the register
+ * pointer, EEPROM address and 0xfc/0xfd/0xfe command and count bytes,
+ * data_bytes the payload.
+ */
+struct adm1166_bus_stats {
+	unsigned long long xfers;
+	unsigned long long msgs;
+	unsigned long long reads;
+	unsigned long long cmd_bytes;
+	unsigned long long data_bytes;
+	unsigned long long erases;
+	unsigned long long writes;
+};
+
+/*
+ * Bus and host parameters for the timing model.  stretch_ns is the clock
+ * stretching per read message, mux_levels the number of I2C mux channel
+ * selects in front of every transaction and host_ns the software cost of
+ * one transaction.  erase_ns and write_ns are the EEPROM cycle times.
+ */
+struct adm1166_bus_model {
+	unsigned int clock_hz;
+	unsigned int stretch_ns;
+	unsigned int mux_levels;
+	unsigned int host_ns;
+	unsigned int erase_ns;
+	unsigned int write_ns;
+};
+
+/* Virtual bus shared by simulated devices, see adm1166_sim_attach() */
+struct adm1166_sim_bus;
+
+int adm1166_parse_target(const char *spec, unsigned int *bus,
+	unsigned int *addr);
+int adm1166_open(struct adm1166 *dev, unsigned int bus, unsigned int addr);
+int adm1166_open_target(struct adm1166 *dev, const char *spec);
+int adm1166_source_is_image(const char *source);
+void adm1166_close(struct adm1166 *dev);
+
+int adm1166_xfer(struct adm1166 *dev, struct i2c_msg *msgs,
+	unsigned int nmsgs);
+
+int adm1166_reg_read(struct adm1166 *dev, unsigned int reg,
+	unsigned char *val);
+int adm1166_reg_write(struct adm1166 *dev, unsigned int reg,
+	unsigned char val);
+int adm1166_regs_read(struct adm1166 *dev, unsigned int reg,
+	unsigned char *buf, unsigned int len);
+int adm1166_eeprom_read(struct adm1166 *dev, unsigned int addr,
+	unsigned char *buf);
+int adm1166_eeprom_erase(struct adm1166 *dev, unsigned int addr);
+int adm1166_eeprom_write(struct adm1166 *dev, unsigned int addr,
+	const unsigned char *buf);
+int adm1166_eeprom_download(struct adm1166 *dev);
+int adm1166_adc_read(struct adm1166 *dev, unsigned int ch,
+	unsigned int *code);
+int adm1166_adc_channel_by_name(const char *name);
+const char *adm1166_adc_channel_name(unsigned int ch);
+
+int adm1166_sample_read(struct adm1166 *dev, struct adm1166_sample *s);
+int adm1166_sample_read_channels(struct adm1166 *dev, unsigned int mask,
+	struct adm1166_sample *s);
+unsigned int adm1166_readback_cycle_us(unsigned int mask, int avg);
+int adm1166_readback_setup(struct adm1166 *dev,
+	const struct adm1166_readback *rb);
+int adm1166_readback_tune(struct adm1166 *dev, unsigned int mask, float noise,
+	unsigned int interval_us, struct adm1166_readback *rb);
+void adm1166_sample_print_header(FILE *f);
+void adm1166_sample_print(FILE *f, const struct adm1166_sample *s);
+int adm1166_sample_parse(const char *line, struct adm1166_sample *s);
+
+int adm1166_samples_encode(struct proto_buf *b,
+	const struct adm1166_sample *s, unsigned int n);
+int adm1166_samples_decode(const unsigned char *p, unsigned int len,
+	struct adm1166_sample *s, unsigned int max);
+int adm1166_event_encode(struct proto_buf *b, const struct adm1166_event *ev);
+int adm1166_event_decode(const unsigned char *p, unsigned int len,
+	struct adm1166_event *ev);
+
+void adm1166_signature_compute(const struct adm1166_sample *s,
+	unsigned int n, struct adm1166_signature *sig);
+void adm1166_signature_feature_name(unsigned int i, char *buf,
+	unsigned int len);
+
+int adm1166_image_load(struct adm1166_image *img, const char *path);
+int adm1166_image_read(struct adm1166 *dev, struct adm1166_image *img);
+int adm1166_image_valid(const struct adm1166_image *img, unsigned int off);
+int adm1166_bundle_load(const char *path, unsigned int threads,
+	struct adm1166_image **imgs, unsigned int **first_line);
+int adm1166_image_encode(struct proto_buf *b, const struct adm1166_image *img);
+int adm1166_image_decode(const unsigned char **p, const unsigned char *end,
+	struct adm1166_image *img);
+void adm1166_se_decode(const unsigned char *buf, struct adm1166_se_state *st);
+unsigned long long adm1166_se_reachable(const unsigned char *se);
+
+int adm1166_page_reserved(unsigned int addr);
+int adm1166_plan(struct adm1166 *dev, const struct adm1166_image *img,
+	struct adm1166_plan *plan, FILE *log);
+int adm1166_plan_execute(struct adm1166 *dev, const struct adm1166_plan *plan,
+	FILE *log);
+int adm1166_activate(struct adm1166 *dev, const struct adm1166_plan *plan,
+	FILE *log);
+int adm1166_verify(struct adm1166 *dev, const struct adm1166_image *img,
+	unsigned int *first);
+void adm1166_scrub_init(struct adm1166_scrub *scrub,
+	const struct adm1166_image *ref);
+int adm1166_scrub_step(struct adm1166 *dev, struct adm1166_scrub *scrub,
+	unsigned int *addr);
+
+const char *adm1166_reg_name(unsigned int reg);
+const char *adm1166_eeprom_name(unsigned int addr);
+void adm1166_report(FILE *f, const char *source,
+	const struct adm1166_image *img, const unsigned char *regs,
+	char * const *names, unsigned int flags);
+unsigned int adm1166_drift(const unsigned char *live, const unsigned char *ee,
+	const unsigned char *ignore, struct adm1166_drift *d);
+void adm1166_drift_print(FILE *f, const char *prefix,
+	const struct adm1166_drift *d);
+
+int adm1166_sim_open(struct adm1166 *dev, const char *image);
+int adm1166_sim_couple(struct adm1166 *dev, unsigned int dac,
+	unsigned int ch);
+int adm1166_sim_power_cycle(struct adm1166 *dev);
+int adm1166_sim_set_temp(struct adm1166 *dev, int temp_mc);
+struct adm1166_sim_bus *adm1166_sim_bus_new(const struct adm1166_bus_model *model);
+void adm1166_sim_bus_free(struct adm1166_sim_bus *bus);
+int adm1166_sim_attach(struct adm1166 *dev, struct adm1166_sim_bus *bus);
+int adm1166_sim_bus_stats(struct adm1166 *dev, struct adm1166_bus_stats *stats,
+	int reset);
+unsigned long long adm1166_bus_time_ns(const struct adm1166_bus_stats *stats,
+	const struct adm1166_bus_model *model);
+unsigned long long adm1166_wall_time_ns(const struct adm1166_bus_stats *stats,
+	const struct adm1166_bus_model *model);
+
+#endif
@@ -0,0 +1,356 @@
+/*
+ * Copyright (C) 2015-2016 Analog Devices, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * */
+
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "adm1166.h"
+#include "proto.h"
+
+#define MAX_CLIENTS	16
+#define MAX_SAMPLES	1000
+
+struct client {
+	int fd;
+	struct proto_buf in;
+	struct adm1166_plan *plan;
+};
+
+static struct adm1166 dev;
+static struct client clients[MAX_CLIENTS];
+static struct pollfd pfds[MAX_CLIENTS + 1];
+static unsigned int num_clients;
+static int verbose;
+
+static volatile sig_atomic_t stop;
+
+static void handle_signal(int sig)
+{
+	stop = 1;
+}
+
+static int call_snapshot(struct client *c, const unsigned char *p,
+	const unsigned char *end, struct proto_buf *out)
+{
+	struct adm1166_image img;
+	int ret;
+
+	ret = adm1166_image_read(&dev, &img);
+	if (ret < 0)
+		return ret;
+
+	return adm1166_image_encode(out, &img);
+}
+
+static int call_plan(struct client *c, const unsigned char *p,
+	const unsigned char *end, struct proto_buf *out)
+{
+	struct adm1166_image img;
+	unsigned int i;
+	int ret;
+
+	if (adm1166_image_decode(&p, end, &img) < 0)
+		return -EINVAL;
+
+	if (c->plan == NULL) {
+		c->plan = malloc(sizeof(*c->plan));
+		if (c->plan == NULL)
+			return -ENOMEM;
+	}
+	ret = adm1166_plan(&dev, &img, c->plan, NULL);
+	if (ret < 0) {
+		free(c->plan);
+		c->plan = NULL;
+		return ret;
+	}
+
+	ret = proto_put_varint(out, c->plan->num_pages);
+	for (i = 0; i < c->plan->num_pages && ret == 0; i++)
+		ret = proto_put_varint(out, c->plan->pages[i]);
+
+	return ret;
+}
+
+/* Programs the plan of the previous PLAN call on this connection */
+static int call_program(struct client *c, const unsigned char *p,
+	const unsigned char *end, struct proto_buf *out)
+{
+	unsigned long long flags;
+	unsigned int pages;
+	int ret;
+
+	if (proto_get_varint(&p, end, &flags) < 0)
+		return -EINVAL;
+	if (c->plan == NULL)
+		return -ENOENT;
+
+	pages = c->plan->num_pages;
+	ret = adm1166_plan_execute(&dev, c->plan, NULL);
+	if (ret == 0 && pages && !(flags & ADM1166_RPC_NO_ACTIVATE))
+		ret = adm1166_activate(&dev, c->plan, NULL);
+	free(c->plan);
+	c->plan = NULL;
+	if (ret < 0)
+		return ret;
+
+	return proto_put_varint(out, pages);
+}
+
+static int call_verify(struct client *c, const unsigned char *p,
+	const unsigned char *end, struct proto_buf *out)
+{
+	struct adm1166_image img;
+	unsigned int first;
+	int ret;
+
+	if (adm1166_image_decode(&p, end, &img) < 0)
+		return -EINVAL;
+
+	ret = adm1166_verify(&dev, &img, &first);
+	if (ret < 0)
+		return ret;
+
+	ret = proto_put_varint(out, ret);
+	if (ret == 0)
+		ret = proto_put_varint(out, first);
+
+	return ret;
+}
+
+static int call_telemetry(struct client *c, const unsigned char *p,
+	const unsigned char *end, struct proto_buf *out)
+{
+	unsigned long long n, interval_ms;
+	struct adm1166_sample *s;
+	unsigned int i;
+	int ret = 0;
+
+	if (proto_get_varint(&p, end, &n) < 0 ||
+	    proto_get_varint(&p, end, &interval_ms) < 0 ||
+	    n > MAX_SAMPLES || interval_ms > 60000)
+		return -EINVAL;
+
+	s = malloc((n ? n : 1) * sizeof(*s));
+	if (s == NULL)
+		return -ENOMEM;
+	for (i = 0; i < n && ret == 0; i++) {
+		if (i)
+			usleep(interval_ms * 1000);
+		ret = adm1166_sample_read(&dev, &s[i]);
+	}
+	if (ret == 0)
+		ret = adm1166_samples_encode(out, s, n);
+	free(s);
+
+	return ret;
+}
+
+static const struct {
+	unsigned int type;
+	const char *name;
+	int (*call)(struct client *c, const unsigned char *p,
+		const unsigned char *end, struct proto_buf *out);
+} calls[] = {
+	{ ADM1166_RPC_SNAPSHOT, "snapshot", call_snapshot },
+	{ ADM1166_RPC_PLAN, "plan", call_plan },
+	{ ADM1166_RPC_PROGRAM, "program", call_program },
+	{ ADM1166_RPC_VERIFY, "verify", call_verify },
+	{ ADM1166_RPC_TELEMETRY, "telemetry", call_telemetry },
+};
+
+/* Appends the framed reply to *replies */
+static int handle_call(struct client *c, unsigned int type,
+	const unsigned char *p, size_t len, struct proto_buf *replies)
+{
+	const unsigned char *end = p + len;
+	struct proto_buf hdr = { NULL, 0, 0 }, res = { NULL, 0, 0 };
+	unsigned long long id;
+	unsigned int i;
+	int ret = -ENOSYS, err;
+
+	if (proto_get_varint(&p, end, &id) < 0)
+		return -EINVAL;
+
+	for (i = 0; i < sizeof(calls) / sizeof(calls[0]); i++) {
+		if (calls[i].type != type)
+			continue;
+		ret = calls[i].call(c, p, end, &res);
+		if (verbose)
+			fprintf(stderr, "%s %llu: %d\n", calls[i].name, id, ret);
+		break;
+	}
+	if (ret < 0)
+		res.len = 0;
+
+	err = proto_put_varint(&hdr, id);
+	if (err == 0)
+		err = proto_put_svarint(&hdr, ret < 0 ? ret : 0);
+	if (err == 0 && res.len)
+		err = proto_put_bytes(&hdr, res.data, res.len);
+	ret = err;
+	if (ret == 0)
+		ret = proto_frame(replies, ADM1166_RPC_REPLY, hdr.data, hdr.len);
+	proto_buf_free(&hdr);
+	proto_buf_free(&res);
+
+	return ret;
+}
+
+static void client_close(unsigned int i)
+{
+	close(clients[i].fd);
+	proto_buf_free(&clients[i].in);
+	free(clients[i].plan);
+
+	num_clients--;
+	clients[i] = clients[num_clients];
+	pfds[i + 1] = pfds[num_clients + 1];
+}
+
+/*
+ * Runs every complete request in the input, in order, and sends the
+ * replies back in one go, so a pipelined batch costs one round trip.
+ */
+static int client_read(struct client *c)
+{
+	struct proto_buf replies = { NULL, 0, 0 };
+	const unsigned char *payload;
+	unsigned char buf[65536];
+	unsigned int type;
+	size_t plen, off = 0;
+	ssize_t ret;
+	int flen, err = 0;
+
+	ret = recv(c->fd, buf, sizeof(buf), 0);
+	if (ret <= 0)
+		return -1;
+	if (proto_put_bytes(&c->in, buf, ret) < 0)
+		return -1;
+
+	while ((flen = proto_next_frame(c->in.data + off, c->in.len - off,
+			&type, &payload, &plen)) > 0) {
+		if (handle_call(c, type, payload, plen, &replies) < 0) {
+			err = -1;
+			break;
+		}
+		off += flen;
+	}
+	if (flen < 0)
+		err = -1;
+
+	if (replies.len && proto_send_all(c->fd, replies.data, replies.len) < 0)
+		err = -1;
+	proto_buf_free(&replies);
+
+	memmove(c->in.data, c->in.data + off, c->in.len - off);
+	c->in.len -= off;
+
+	return err;
+}
+
+static void usage(const char *name)
+{
+	printf("Usage: %s [-v] [-t <target>] <host:port>\n\n"
+		"Serves snapshot, plan, program, verify and telemetry calls for\n"
+		"the ADM1166 at <target> to adm1166_orch.  Calls are run one at a\n"
+		"time in the order they arrive.\n", name);
+}
+
+int main(int argc, char *argv[])
+{
+	const char *target = "0";
+	unsigned int i;
+	int opt, fd;
+
+	while ((opt = getopt(argc, argv, "t:v")) != -1) {
+		switch (opt) {
+		case 't':
+			target = optarg;
+			break;
+		case 'v':
+			verbose = 1;
+			break;
+		default:
+			usage(argv[0]);
+			exit(1);
+		}
+	}
+
+	if (optind + 1 != argc) {
+		usage(argv[0]);
+		return 0;
+	}
+
+	if (adm1166_open_target(&dev, target) < 0)
+		exit(1);
+
+	pfds[0].fd = proto_listen(argv[optind]);
+	if (pfds[0].fd < 0) {
+		fprintf(stderr, "Failed to listen on %s: %d\n", argv[optind],
+			-pfds[0].fd);
+		adm1166_close(&dev);
+		exit(1);
+	}
+	pfds[0].events = POLLIN;
+
+	signal(SIGINT, handle_signal);
+	signal(SIGTERM, handle_signal);
+	signal(SIGPIPE, SIG_IGN);
+
+	while (!stop) {
+		if (poll(pfds, num_clients + 1, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("poll");
+			break;
+		}
+
+		for (i = 0; i < num_clients; ) {
+			if (pfds[i + 1].revents && client_read(&clients[i]) < 0) {
+				client_close(i);
+				continue;
+			}
+			i++;
+		}
+
+		if (pfds[0].revents & POLLIN) {
+			fd = accept(pfds[0].fd, NULL, NULL);
+			if (fd < 0)
+				continue;
+			if (num_clients == MAX_CLIENTS) {
+				close(fd);
+				continue;
+			}
+			memset(&clients[num_clients], 0x00, sizeof(clients[0]));
+			clients[num_clients].fd = fd;
+			pfds[num_clients + 1].fd = fd;
+			pfds[num_clients + 1].events = POLLIN;
+			num_clients++;
+		}
+	}
+
+	while (num_clients)
+		client_close(0);
+	close(pfds[0].fd);
+	adm1166_close(&dev);
+
+	return 0;
+}
@@ -0,0 +1,531 @@
+/*
+ * Copyright (C) 2015-2016 Analog Devices, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * */
+
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#include "adm1166.h"
+#include "proto.h"
+
+#define BATCH		50
+
+enum mode {
+	MODE_PROGRAM,
+	MODE_TELEMETRY,
+};
+
+struct target {
+	struct adm1166 dev;
+	int fd;
+	struct proto_queue q;
+	struct adm1166_sample batch[BATCH];
+	unsigned int num;
+};
+
+struct worker {
+	pthread_t tid;
+	unsigned int id;
+	unsigned long long *lat;
+	unsigned int num;
+	unsigned int size;
+	unsigned long long samples;
+	unsigned long long errors;
+};
+
+static struct {
+	enum mode mode;
+	struct target *targets;
+	unsigned int num_targets;
+	unsigned int num_workers;
+	unsigned int active;
+	unsigned int interval_ms;
+	unsigned int duration_s;
+	const char *endpoint;
+	const struct adm1166_image *image;
+	unsigned long long start_ns;
+	unsigned long long dropped;
+	pthread_mutex_t lock;
+} bench;
+
+static unsigned long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void sleep_until_ns(unsigned long long t)
+{
+	struct timespec ts = { t / 1000000000ULL, t % 1000000000ULL };
+
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) ==
+	       EINTR)
+		;
+}
+
+static void record(struct worker *w, unsigned long long ns)
+{
+	unsigned long long *tmp;
+
+	if (w->num == w->size) {
+		w->size = w->size ? w->size * 2 : 1024;
+		tmp = realloc(w->lat, w->size * sizeof(*tmp));
+		if (tmp == NULL)
+			return;
+		w->lat = tmp;
+	}
+	w->lat[w->num++] = ns;
+}
+
+/* Each worker takes every num_workers-th target, like one job slot */
+static void *program_worker(void *arg)
+{
+	struct worker *w = arg;
+	struct adm1166_plan *plan;
+	unsigned long long t0;
+	unsigned int i;
+	int ret;
+
+	plan = malloc(sizeof(*plan));
+	if (plan == NULL)
+		return NULL;
+
+	for (i = w->id; i < bench.num_targets; i += bench.active) {
+		t0 = now_ns();
+		ret = adm1166_plan(&bench.targets[i].dev, bench.image, plan, NULL);
+		if (ret == 0)
+			ret = adm1166_plan_execute(&bench.targets[i].dev, plan, NULL);
+		if (ret == 0)
+			ret = adm1166_activate(&bench.targets[i].dev, plan, NULL);
+		if (ret < 0) {
+			w->errors++;
+			continue;
+		}
+		record(w, now_ns() - t0);
+		w->samples++;
+	}
+	free(plan);
+
+	return NULL;
+}
+
+static void push(struct target *t)
+{
+	struct proto_buf b = { NULL, 0, 0 };
+
+	if (adm1166_samples_encode(&b, t->batch, t->num) == 0 &&
+	    proto_queue_push(&t->q, ADM1166_MSG_SAMPLES, b.data, b.len) < 0)
+		t->q.dropped++;
+	proto_buf_free(&b);
+	t->num = 0;
+
+	if (t->fd >= 0 && proto_queue_flush(&t->q, t->fd) < 0) {
+		close(t->fd);
+		t->fd = -1;
+	}
+}
+
+static int hello(struct target *t, unsigned int i)
+{
+	struct proto_buf b = { NULL, 0, 0 };
+	char id[32];
+	int ret;
+
+	t->fd = proto_connect(bench.endpoint, 5000);
+	if (t->fd < 0)
+		return t->fd;
+
+	snprintf(id, sizeof(id), "bench-%u", i);
+	ret = proto_put_varint(&b, ADM1166_PROTO_VERSION);
+	if (ret == 0)
+		ret = proto_put_bytes(&b, id, strlen(id));
+	if (ret == 0)
+		ret = proto_queue_push(&t->q, ADM1166_MSG_HELLO, b.data,
+			b.len);
+	proto_buf_free(&b);
+
+	return ret;
+}
+
+/*
+ * Every tick the worker samples all of its targets in turn, the latency
+ * of a sample is measured from the tick, so a worker that cannot keep up
+ * shows as a growing tail.
+ */
+static void *telemetry_worker(void *arg)
+{
+	struct worker *w = arg;
+	unsigned long long tick, end;
+	struct adm1166_sample s;
+	struct target *t;
+	unsigned int i;
+
+	end = bench.start_ns + bench.duration_s * 1000000000ULL;
+	for (tick = bench.start_ns; tick < end;
+	     tick += bench.interval_ms * 1000000ULL) {
+		sleep_until_ns(tick);
+		for (i = w->id; i < bench.num_targets; i += bench.active) {
+			t = &bench.targets[i];
+			if (adm1166_sample_read(&t->dev, &s) < 0) {
+				w->errors++;
+				continue;
+			}
+			record(w, now_ns() - tick);
+			w->samples++;
+			if (bench.endpoint == NULL)
+				continue;
+			t->batch[t->num++] = s;
+			if (t->num == BATCH)
+				push(t);
+		}
+	}
+
+	return NULL;
+}
+
+static int cmp_ull(const void *a, const void *b)
+{
+	unsigned long long x = *(const unsigned long long *)a;
+	unsigned long long y = *(const unsigned long long *)b;
+
+	return (x > y) - (x < y);
+}
+
+static long rss_kib(void)
+{
+	long pages = 0, rss = 0;
+	FILE *f;
+
+	f = fopen("/proc/self/statm", "r");
+	if (f == NULL)
+		return 0;
+	if (fscanf(f, "%ld %ld", &pages, &rss) != 2)
+		rss = 0;
+	fclose(f);
+
+	return rss * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+static double cpu_s(const struct rusage *ru)
+{
+	return ru->ru_utime.tv_sec + ru->ru_utime.tv_usec / 1e6 +
+		ru->ru_stime.tv_sec + ru->ru_stime.tv_usec / 1e6;
+}
+
+static void fmt_ns(char *buf, size_t len, unsigned long long ns)
+{
+	if (ns >= 1000000000ULL)
+		snprintf(buf, len, "%.2f s", ns / 1e9);
+	else if (ns >= 1000000ULL)
+		snprintf(buf, len, "%.2f ms", ns / 1e6);
+	else
+		snprintf(buf, len, "%.1f us", ns / 1e3);
+}
+
+static int run(const char *sim_spec, unsigned int count, unsigned int per_bus,
+	const struct adm1166_bus_model *model)
+{
+	struct adm1166_sim_bus **buses;
+	struct worker *workers;
+	struct rusage ru0, ru1;
+	unsigned long long *all, total = 0, errors = 0, elapsed;
+	unsigned int i, j, n = 0, num_buses, workers_n, lost = 0;
+	char p50[16], p99[16], max[16];
+	long rss0, rss1;
+	int ret = 0;
+
+	num_buses = (count + per_bus - 1) / per_bus;
+	workers_n = bench.num_workers < count ? bench.num_workers : count;
+
+	rss0 = rss_kib();
+	bench.targets = calloc(count, sizeof(*bench.targets));
+	buses = calloc(num_buses, sizeof(*buses));
+	workers = calloc(workers_n, sizeof(*workers));
+	if (bench.targets == NULL || buses == NULL || workers == NULL)
+		return -ENOMEM;
+
+	for (i = 0; i < num_buses; i++) {
+		buses[i] = adm1166_sim_bus_new(model);
+		if (buses[i] == NULL)
+			return -ENOMEM;
+	}
+	for (i = 0; i < count; i++) {
+		bench.targets[i].fd = -1;
+		bench.targets[i].q.max = 64 * 1024;
+		ret = adm1166_open_target(&bench.targets[i].dev, sim_spec);
+		if (ret < 0)
+			break;
+		bench.num_targets++;
+		adm1166_sim_attach(&bench.targets[i].dev, buses[i / per_bus]);
+		if (bench.endpoint)
+			hello(&bench.targets[i], i);
+	}
+	if (ret < 0)
+		goto out;
+
+	bench.active = workers_n;
+	getrusage(RUSAGE_SELF, &ru0);
+	bench.start_ns = now_ns() + 10000000ULL;
+	for (i = 0; i < workers_n; i++) {
+		workers[i].id = i;
+		if (pthread_create(&workers[i].tid, NULL,
+				   bench.mode == MODE_PROGRAM ? program_worker :
+				   telemetry_worker, &workers[i])) {
+			fprintf(stderr, "Failed to start worker %u\n", i);
+			workers_n = i;
+			break;
+		}
+	}
+	for (i = 0; i < workers_n; i++)
+		pthread_join(workers[i].tid, NULL);
+	elapsed = now_ns() - bench.start_ns;
+	getrusage(RUSAGE_SELF, &ru1);
+
+	for (i = 0; i < bench.num_targets && bench.endpoint; i++) {
+		if (bench.targets[i].num)
+			push(&bench.targets[i]);
+		if (bench.targets[i].fd < 0)
+			lost++;
+		bench.dropped += bench.targets[i].q.dropped;
+	}
+	rss1 = rss_kib();
+
+	for (i = 0; i < workers_n; i++)
+		total += workers[i].num;
+	all = malloc((total ? total : 1) * sizeof(*all));
+	if (all == NULL) {
+		ret = -ENOMEM;
+		goto out;
+	}
+	for (i = 0; i < workers_n; i++) {
+		for (j = 0; j < workers[i].num; j++)
+			all[n++] = workers[i].lat[j];
+		errors += workers[i].errors;
+	}
+	qsort(all, n, sizeof(*all), cmp_ull);
+
+	fmt_ns(p50, sizeof(p50), n ? all[n / 2] : 0);
+	fmt_ns(p99, sizeof(p99), n ? all[n * 99 / 100] : 0);
+	fmt_ns(max, sizeof(max), n ? all[n - 1] : 0);
+	printf("%-9s %7u %7u %10.1f/s %10s %10s %10s %8.2f KiB %5.1f%%",
+		bench.mode == MODE_PROGRAM ? "program" : "telemetry", count,
+		workers_n, n * 1e9 / elapsed, p50, p99, max,
+		(double)(rss1 - rss0) / count,
+		100 * (cpu_s(&ru1) - cpu_s(&ru0)) / (elapsed / 1e9));
+	if (errors)
+		printf("  %llu errors", errors);
+	if (bench.endpoint)
+		printf("  %u disconnected, %llu frames dropped", lost,
+			bench.dropped);
+	printf("\n");
+	fflush(stdout);
+	free(all);
+
+out:
+	for (i = 0; i < bench.num_targets; i++) {
+		adm1166_close(&bench.targets[i].dev);
+		if (bench.targets[i].fd >= 0)
+			close(bench.targets[i].fd);
+		proto_buf_free(&bench.targets[i].q.buf);
+	}
+	for (i = 0; i < num_buses; i++)
+		adm1166_sim_bus_free(buses[i]);
+	for (i = 0; i < workers_n; i++)
+		free(workers[i].lat);
+	free(workers);
+	free(buses);
+	free(bench.targets);
+	bench.targets = NULL;
+	bench.num_targets = 0;
+	bench.dropped = 0;
+
+	return ret;
+}
+
+static pid_t collector_start(const char *path, const char *endpoint)
+{
+	pid_t pid;
+
+	pid = fork();
+	if (pid == 0) {
+		if (freopen("/dev/null", "w", stdout) == NULL)
+			_exit(1);
+		execl(path, path, endpoint, (char *)NULL);
+		perror("Failed to start the collector");
+		_exit(1);
+	}
+	/* Give it time to bind */
+	usleep(200000);
+
+	return pid;
+}
+
+static void collector_stop(pid_t pid)
+{
+	struct rusage ru;
+	int status;
+
+	kill(pid, SIGINT);
+	if (wait4(pid, &status, 0, &ru) < 0)
+		return;
+	printf("%-9s %38s %.2f s CPU\n", "collector", "", cpu_s(&ru));
+}
+
+static void usage(const char *name)
+{
+	printf("Usage: %s [-m program|telemetry] [-t <targets>[,...]] [-j <workers>]\n"
+		"       [-b <targets-per-bus>] [-c <clock-hz>] [-H <host-us>]\n"
+		"       [-i <interval-ms>] [-d <seconds>] [-p <ihex-file>]\n"
+		"       [-C <collector> [-e <host:port>]] <base-ihex>\n\n"
+		"Runs the programming or telemetry path against growing fleets of\n"
+		"simulated devices loaded with <base-ihex>.  Every <targets-per-bus>\n"
+		"devices share a virtual bus that is held for the modelled time of\n"
+		"each transaction.  Reports throughput, latency percentiles (per\n"
+		"target when programming <ihex-file>, per sample from its tick\n"
+		"otherwise), resident memory per target and CPU use.  With -C the\n"
+		"telemetry of every target is pushed to a collector started from\n"
+		"that binary, over one connection per target.\n", name);
+}
+
+int main(int argc, char *argv[])
+{
+	struct adm1166_bus_model model = {
+		.clock_hz = 400000,
+		.host_ns = 50000,
+	};
+	const char *counts = "10,100,1000", *collector = NULL;
+	const char *new_path = NULL;
+	unsigned int per_bus = 8, count;
+	struct adm1166_image image;
+	struct rlimit rl;
+	char spec[512], *p, *end;
+	pid_t pid = -1;
+	int opt, ret = 0;
+
+	bench.mode = MODE_TELEMETRY;
+	bench.num_workers = 64;
+	bench.interval_ms = 100;
+	bench.duration_s = 5;
+	bench.endpoint = NULL;
+
+	while ((opt = getopt(argc, argv, "b:c:C:d:e:H:i:j:m:p:t:")) != -1) {
+		switch (opt) {
+		case 'b':
+			per_bus = strtoul(optarg, NULL, 0);
+			break;
+		case 'c':
+			model.clock_hz = strtoul(optarg, NULL, 0);
+			break;
+		case 'C':
+			collector = optarg;
+			break;
+		case 'd':
+			bench.duration_s = strtoul(optarg, NULL, 0);
+			break;
+		case 'e':
+			bench.endpoint = optarg;
+			break;
+		case 'H':
+			model.host_ns = strtoul(optarg, NULL, 0) * 1000;
+			break;
+		case 'i':
+			bench.interval_ms = strtoul(optarg, NULL, 0);
+			break;
+		case 'j':
+			bench.num_workers = strtoul(optarg, NULL, 0);
+			break;
+		case 'm':
+			if (strcmp(optarg, "program") == 0) {
+				bench.mode = MODE_PROGRAM;
+			} else if (strcmp(optarg, "telemetry") != 0) {
+				usage(argv[0]);
+				exit(1);
+			}
+			break;
+		case 'p':
+			new_path = optarg;
+			break;
+		case 't':
+			counts = optarg;
+			break;
+		default:
+			usage(argv[0]);
+			exit(1);
+		}
+	}
+
+	if (optind + 1 != argc || per_bus == 0 || bench.num_workers == 0 ||
+	    model.clock_hz == 0 || bench.interval_ms == 0) {
+		usage(argv[0]);
+		return 0;
+	}
+	snprintf(spec, sizeof(spec), "sim:%s", argv[optind]);
+
+	if (adm1166_image_load(&image, new_path ? new_path : argv[optind]) < 0)
+		exit(1);
+	/* Without a new image move the first threshold by one code */
+	if (new_path == NULL)
+		image.data[ADM1166_REG_OVTH(0)]++;
+	bench.image = &image;
+
+	/* One socket per target */
+	if (getrlimit(RLIMIT_NOFILE, &rl) == 0) {
+		rl.rlim_cur = rl.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &rl);
+	}
+	signal(SIGPIPE, SIG_IGN);
+
+	if (collector) {
+		if (bench.mode != MODE_TELEMETRY) {
+			usage(argv[0]);
+			exit(1);
+		}
+		if (bench.endpoint == NULL)
+			bench.endpoint = "127.0.0.1:17166";
+		pid = collector_start(collector, bench.endpoint);
+		if (pid < 0)
+			exit(1);
+	}
+
+	printf("%-9s %7s %7s %12s %10s %10s %10s %12s %6s\n", "Mode",
+		"Targets", "Workers", "Throughput", "p50", "p99", "max",
+		"Mem/target", "CPU");
+
+	for (p = (char *)counts; *p; p = end + (*end == ',')) {
+		count = strtoul(p, &end, 0);
+		if (end == p || count == 0) {
+			fprintf(stderr, "Invalid target count list %s\n", counts);
+			ret = -EINVAL;
+			break;
+		}
+		ret = run(spec, count, per_bus, &model);
+		if (ret < 0)
+			break;
+	}
+
+	if (pid > 0)
+		collector_stop(pid);
+
+	return ret < 0 ? 1 : 0;
+}
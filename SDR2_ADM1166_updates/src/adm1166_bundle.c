@@ -0,0 +1,97 @@
+/*
+ * Copyright (C) 2015-2016 Analog Devices, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "adm1166.h"
+
+static void print_image(unsigned int n, unsigned int line,
+	const struct adm1166_image *img)
+{
+	unsigned int off, bytes = 0, cfg = 0;
+	unsigned int v = ADM1166_EE_CFG_VERSION - ADM1166_EEPROM_BASE;
+
+	for (off = 0; off < ADM1166_EEPROM_SIZE; off++) {
+		if (!adm1166_image_valid(img, off))
+			continue;
+		bytes++;
+		if (off < ADM1166_USER_BASE - ADM1166_EEPROM_BASE ||
+		    off >= ADM1166_SE_BASE - ADM1166_EEPROM_BASE)
+			cfg++;
+	}
+
+	printf("%-6u %-7u %-14s %5u", n, line, cfg ? "configuration" :
+		"user preset", bytes);
+	if (adm1166_image_valid(img, v) && adm1166_image_valid(img, v + 2))
+		printf("  %02X%02X - %02X", img->data[v + 2], img->data[v + 1],
+			img->data[v]);
+	printf("\n");
+}
+
+static void usage(const char *name)
+{
+	printf("Usage: %s [-j <threads>] <bundle>\n\n"
+		"Validates a bundle of concatenated ihex images, syntax, record\n"
+		"checksums and EEPROM addresses, and lists its images.  Large\n"
+		"bundles are parsed on up to <threads> threads, by default one\n"
+		"per CPU.\n", name);
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned int threads = sysconf(_SC_NPROCESSORS_ONLN);
+	struct adm1166_image *imgs;
+	struct timespec t0, t1;
+	unsigned int *lines;
+	int opt, i, n;
+
+	while ((opt = getopt(argc, argv, "j:")) != -1) {
+		switch (opt) {
+		case 'j':
+			threads = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+			exit(1);
+		}
+	}
+
+	if (optind + 1 != argc) {
+		usage(argv[0]);
+		return 0;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	n = adm1166_bundle_load(argv[optind], threads, &imgs, &lines);
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	if (n < 0)
+		exit(1);
+
+	printf("%-6s %-7s %-14s %5s  %s\n", "Image", "Line", "Kind", "Bytes",
+		"Version");
+	for (i = 0; i < n; i++)
+		print_image(i + 1, lines[i], &imgs[i]);
+
+	fprintf(stderr, "Loaded %d images in %.1f ms\n", n,
+		(t1.tv_sec - t0.tv_sec) * 1e3 + (t1.tv_nsec - t0.tv_nsec) / 1e6);
+
+	free(imgs);
+	free(lines);
+
+	return 0;
+}
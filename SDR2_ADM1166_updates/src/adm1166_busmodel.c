@@ -0,0 +1,192 @@
+/*
+ * Copyright (C) 2015-2016 Analog Devices, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "adm1166.h"
+
+static const unsigned int clocks[] = { 100000, 400000, 1000000 };
+
+/* The page sequence of adm1166_plan_execute(), without the settle delays */
+static int replay_program(struct adm1166 *dev, const char *path)
+{
+	static struct adm1166_plan plan;
+	unsigned char rbuf[ADM1166_PAGE_SIZE];
+	struct adm1166_image img;
+	unsigned int i;
+	int ret;
+
+	ret = adm1166_image_load(&img, path);
+	if (ret < 0)
+		return ret;
+
+	ret = adm1166_plan(dev, &img, &plan, NULL);
+	if (ret < 0)
+		return ret;
+
+	adm1166_reg_write(dev, ADM1166_REG_SECTRL, ADM1166_SECTRL_HALT);
+	adm1166_reg_write(dev, ADM1166_REG_UPDCFG, ADM1166_UPDCFG_EEPROM_EN | 0x01);
+
+	for (i = 0; i < plan.num_pages; i++) {
+		ret = adm1166_eeprom_erase(dev, plan.pages[i]);
+		if (ret == 0)
+			ret = adm1166_eeprom_write(dev, plan.pages[i], plan.image.data +
+				plan.pages[i] - ADM1166_EEPROM_BASE);
+		if (ret == 0)
+			ret = adm1166_eeprom_read(dev, plan.pages[i], rbuf);
+		if (ret < 0)
+			return ret;
+	}
+
+	adm1166_reg_write(dev, ADM1166_REG_UPDCFG, 0);
+
+	return adm1166_activate(dev, &plan, NULL);
+}
+
+static int replay_telemetry(struct adm1166 *dev, unsigned int samples)
+{
+	struct adm1166_sample s;
+	unsigned int i;
+	int ret;
+
+	for (i = 0; i < samples; i++) {
+		ret = adm1166_sample_read(dev, &s);
+		if (ret < 0)
+			return ret;
+	}
+
+	return 0;
+}
+
+static void usage(const char *name)
+{
+	printf("Usage: %s [-b <base-ihex>] [-p <ihex-file>] [-n <samples>]\n"
+		"       [-i <interval-ms>] [-d <devices>] [-m <mux-levels>]\n"
+		"       [-s <stretch-us>] [-H <host-us>] [-E <erase-ms>] [-W <write-ms>]\n\n"
+		"Replays a programming run (-p, against a simulated device holding\n"
+		"the base image) or a telemetry run of -n samples against the bus\n"
+		"timing model and predicts wall-clock time and bus occupancy at\n"
+		"100 kHz, 400 kHz and 1 MHz, directly attached and behind up to\n"
+		"<mux-levels> I2C muxes.  For telemetry the occupancy is that of\n"
+		"<devices> sequencers sampled every <interval-ms> on one bus.\n",
+		name);
+}
+
+int main(int argc, char *argv[])
+{
+	struct adm1166_bus_model model = {
+		.stretch_ns = 0,
+		.host_ns = 50000,
+		.erase_ns = 20000000,
+		.write_ns = 5000000,
+	};
+	unsigned int samples = 0, interval_ms = 100, devices = 1, mux_max = 1;
+	unsigned long long bus_ns, wall_ns;
+	struct adm1166_bus_stats stats;
+	const char *base = NULL, *program = NULL;
+	struct adm1166 dev;
+	unsigned int c, m;
+	int opt, ret;
+
+	while ((opt = getopt(argc, argv, "b:d:E:H:i:m:n:p:s:W:")) != -1) {
+		switch (opt) {
+		case 'b':
+			base = optarg;
+			break;
+		case 'd':
+			devices = strtoul(optarg, NULL, 0);
+			break;
+		case 'E':
+			model.erase_ns = strtoul(optarg, NULL, 0) * 1000000;
+			break;
+		case 'H':
+			model.host_ns = strtoul(optarg, NULL, 0) * 1000;
+			break;
+		case 'i':
+			interval_ms = strtoul(optarg, NULL, 0);
+			break;
+		case 'm':
+			mux_max = strtoul(optarg, NULL, 0);
+			break;
+		case 'n':
+			samples = strtoul(optarg, NULL, 0);
+			break;
+		case 'p':
+			program = optarg;
+			break;
+		case 's':
+			model.stretch_ns = strtoul(optarg, NULL, 0) * 1000;
+			break;
+		case 'W':
+			model.write_ns = strtoul(optarg, NULL, 0) * 1000000;
+			break;
+		default:
+			usage(argv[0]);
+			exit(1);
+		}
+	}
+
+	if (optind != argc || (!program && !samples) || (program && samples) ||
+	    interval_ms == 0) {
+		usage(argv[0]);
+		return 0;
+	}
+
+	if (adm1166_sim_open(&dev, base) < 0)
+		exit(1);
+	adm1166_sim_bus_stats(&dev, NULL, 1);
+
+	if (program)
+		ret = replay_program(&dev, program);
+	else
+		ret = replay_telemetry(&dev, samples);
+	adm1166_sim_bus_stats(&dev, &stats, 0);
+	adm1166_close(&dev);
+
+	if (ret < 0) {
+		fprintf(stderr, "Replay failed: %d\n", ret);
+		exit(1);
+	}
+
+	printf("%llu transactions, %llu messages, %llu command and %llu data "
+		"bytes, %llu erases, %llu writes\n\n", stats.xfers, stats.msgs,
+		stats.cmd_bytes, stats.data_bytes, stats.erases, stats.writes);
+	printf("%-8s %-5s %12s %12s %10s\n", "Clock", "Muxes", "Bus ms",
+		program ? "Wall ms" : "ms/sample", "Occupancy");
+
+	for (c = 0; c < sizeof(clocks) / sizeof(clocks[0]); c++) {
+		for (m = 0; m <= mux_max; m++) {
+			model.clock_hz = clocks[c];
+			model.mux_levels = m;
+			bus_ns = adm1166_bus_time_ns(&stats, &model);
+			wall_ns = adm1166_wall_time_ns(&stats, &model);
+			if (program)
+				printf("%-8u %-5u %12.3f %12.3f %9.1f%%\n", clocks[c], m,
+					bus_ns / 1e6, wall_ns / 1e6,
+					100.0 * bus_ns / wall_ns);
+			else
+				printf("%-8u %-5u %12.3f %12.3f %9.1f%%\n", clocks[c], m,
+					bus_ns / 1e6, wall_ns / 1e6 / samples,
+					100.0 * devices * bus_ns / samples /
+					(interval_ms * 1e6));
+		}
+	}
+
+	return 0;
+}
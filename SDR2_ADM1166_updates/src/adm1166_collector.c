@@ -0,0 +1,282 @@
+/*
+ * Copyright (C) 2015-2016 Analog Devices, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * */
+
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "adm1166.h"
+#include "proto.h"
+
+#define MAX_CLIENTS	1024
+
+struct client {
+	int fd;
+	char id[64];
+	FILE *log;
+	struct proto_buf in;
+};
+
+static struct client clients[MAX_CLIENTS];
+static struct pollfd pfds[MAX_CLIENTS + 1];
+static unsigned int num_clients;
+static const char *prefix;
+static unsigned long long rx_bytes, rx_samples, rx_events;
+
+static volatile sig_atomic_t stop;
+
+static void handle_signal(int sig)
+{
+	stop = 1;
+}
+
+static FILE *client_log(struct client *c)
+{
+	char path[256];
+	unsigned int i;
+
+	if (c->log)
+		return c->log;
+	if (prefix == NULL)
+		return stdout;
+
+	snprintf(path, sizeof(path), "%s-%s.log", prefix, c->id);
+	for (i = strlen(prefix) + 1; path[i]; i++) {
+		if (path[i] == ':' || path[i] == '/')
+			path[i] = '-';
+	}
+	c->log = fopen(path, "a");
+	if (c->log == NULL) {
+		perror("Failed to open log file");
+		return stdout;
+	}
+	adm1166_sample_print_header(c->log);
+
+	return c->log;
+}
+
+static int handle_frame(struct client *c, unsigned int type,
+	const unsigned char *p, size_t len)
+{
+	const unsigned char *end = p + len, *q;
+	struct adm1166_sample *s;
+	struct adm1166_event ev;
+	unsigned long long v, n2, ee, live;
+	FILE *f;
+	int i, n;
+
+	switch (type) {
+	case ADM1166_MSG_HELLO:
+		if (proto_get_varint(&p, end, &v) < 0 ||
+		    v != ADM1166_PROTO_VERSION)
+			return -EINVAL;
+		snprintf(c->id, sizeof(c->id), "%.*s", (int)(end - p), p);
+		return 0;
+	case ADM1166_MSG_SAMPLES:
+		q = p;
+		if (proto_get_varint(&q, end, &v) < 0 || v > len)
+			return -EINVAL;
+		s = malloc((v ? v : 1) * sizeof(*s));
+		if (s == NULL)
+			return -ENOMEM;
+		n = adm1166_samples_decode(p, len, s, v);
+		f = client_log(c);
+		for (i = 0; i < n; i++) {
+			if (prefix == NULL)
+				fprintf(f, "%s ", c->id);
+			adm1166_sample_print(f, &s[i]);
+		}
+		free(s);
+		if (n < 0)
+			return n;
+		rx_samples += n;
+		return 0;
+	case ADM1166_MSG_EVENT:
+		if (adm1166_event_decode(p, len, &ev) < 0)
+			return -EINVAL;
+		fprintf(client_log(c), "# %s fault %llu state %u -> %u pdo %03x\n",
+			c->id, ev.t_us, ev.from, ev.to, ev.pdo);
+		rx_events++;
+		return 0;
+	case ADM1166_MSG_SCRUB:
+		if (proto_get_varint(&p, end, &v) < 0 ||
+		    proto_get_varint(&p, end, &v) < 0 ||
+		    proto_get_varint(&p, end, &n2) < 0)
+			return -EINVAL;
+		fprintf(client_log(c), "# %s scrub alarm at %llx, %llu bad\n",
+			c->id, v, n2);
+		return 0;
+	case ADM1166_MSG_DRIFT:
+		if (proto_get_varint(&p, end, &v) < 0 ||
+		    proto_get_varint(&p, end, &n2) < 0 || n2 > len)
+			return -EINVAL;
+		f = client_log(c);
+		fprintf(f, "# %s drift, %llu registers\n", c->id, n2);
+		for (i = 0; i < (int)n2; i++) {
+			if (proto_get_varint(&p, end, &v) < 0 ||
+			    proto_get_varint(&p, end, &ee) < 0 ||
+			    proto_get_varint(&p, end, &live) < 0)
+				return -EINVAL;
+			fprintf(f, "# %s   %s %02llx -> %02llx\n", c->id,
+				adm1166_reg_name(v), ee, live);
+		}
+		return 0;
+	case ADM1166_MSG_DROPPED:
+		if (proto_get_varint(&p, end, &v) < 0)
+			return -EINVAL;
+		fprintf(client_log(c), "# %s dropped %llu frames\n", c->id, v);
+		return 0;
+	}
+
+	/* Unknown frame types are skipped for forward compatibility */
+	return 0;
+}
+
+static void client_close(unsigned int i)
+{
+	close(clients[i].fd);
+	if (clients[i].log)
+		fclose(clients[i].log);
+	proto_buf_free(&clients[i].in);
+
+	num_clients--;
+	clients[i] = clients[num_clients];
+	pfds[i + 1] = pfds[num_clients + 1];
+}
+
+static int client_read(struct client *c)
+{
+	const unsigned char *payload;
+	unsigned char buf[65536];
+	unsigned int type;
+	size_t plen, off = 0;
+	ssize_t ret;
+	int flen;
+
+	ret = recv(c->fd, buf, sizeof(buf), 0);
+	if (ret <= 0)
+		return -1;
+	rx_bytes += ret;
+	if (proto_put_bytes(&c->in, buf, ret) < 0)
+		return -1;
+
+	while ((flen = proto_next_frame(c->in.data + off, c->in.len - off,
+			&type, &payload, &plen)) > 0) {
+		if (type != ADM1166_MSG_HELLO && c->id[0] == '\0')
+			return -1;
+		if (handle_frame(c, type, payload, plen) < 0)
+			return -1;
+		off += flen;
+	}
+	if (flen < 0)
+		return -1;
+
+	memmove(c->in.data, c->in.data + off, c->in.len - off);
+	c->in.len -= off;
+	if (prefix == NULL)
+		fflush(stdout);
+	else if (c->log)
+		fflush(c->log);
+
+	return 0;
+}
+
+static void usage(const char *name)
+{
+	printf("Usage: %s [-o <prefix>] <host:port>\n\n"
+		"Reference collector for adm1166_telemetry -c.  Samples are written\n"
+		"in the telemetry log format, prefixed with the board ID on stdout\n"
+		"or to <prefix>-<id>.log per board.\n", name);
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned int i;
+	int opt, fd;
+
+	while ((opt = getopt(argc, argv, "o:")) != -1) {
+		switch (opt) {
+		case 'o':
+			prefix = optarg;
+			break;
+		default:
+			usage(argv[0]);
+			exit(1);
+		}
+	}
+
+	if (optind + 1 != argc) {
+		usage(argv[0]);
+		return 0;
+	}
+
+	pfds[0].fd = proto_listen(argv[optind]);
+	if (pfds[0].fd < 0) {
+		fprintf(stderr, "Failed to listen on %s: %d\n", argv[optind],
+			-pfds[0].fd);
+		exit(1);
+	}
+	pfds[0].events = POLLIN;
+
+	signal(SIGINT, handle_signal);
+	signal(SIGTERM, handle_signal);
+
+	while (!stop) {
+		if (poll(pfds, num_clients + 1, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("poll");
+			break;
+		}
+
+		for (i = 0; i < num_clients; ) {
+			if (pfds[i + 1].revents && client_read(&clients[i]) < 0) {
+				client_close(i);
+				continue;
+			}
+			i++;
+		}
+
+		if (pfds[0].revents & POLLIN) {
+			fd = accept(pfds[0].fd, NULL, NULL);
+			if (fd < 0)
+				continue;
+			if (num_clients == MAX_CLIENTS) {
+				close(fd);
+				continue;
+			}
+			memset(&clients[num_clients], 0x00, sizeof(clients[0]));
+			clients[num_clients].fd = fd;
+			pfds[num_clients + 1].fd = fd;
+			pfds[num_clients + 1].events = POLLIN;
+			num_clients++;
+		}
+	}
+
+	while (num_clients)
+		client_close(0);
+	close(pfds[0].fd);
+
+	fprintf(stderr, "%llu bytes, %llu samples (%.1f bytes/sample), %llu "
+		"fault events\n", rx_bytes, rx_samples,
+		rx_samples ? (double)rx_bytes / rx_samples : 0.0, rx_events);
+
+	return 0;
+}
@@ -0,0 +1,66 @@
+/*
+ * Copyright (C) 2015-2016 Analog Devices, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "adm1166.h"
+
+static void usage(const char *name)
+{
+	printf("Usage: %s <target>\n\n"
+		"Compares the live configuration registers 0x00-0x9C with their\n"
+		"EEPROM copy at 0xF800 and lists every register that was changed\n"
+		"without being programmed.  Exits with 2 when there is drift.\n",
+		name);
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned char live[ADM1166_NUM_REGS], ee[5 * ADM1166_PAGE_SIZE];
+	struct adm1166_drift d[ADM1166_NUM_REGS];
+	unsigned int i, n;
+	struct adm1166 dev;
+	int ret = 0;
+
+	if (argc != 2) {
+		usage(argv[0]);
+		return 0;
+	}
+
+	if (adm1166_open_target(&dev, argv[1]) < 0)
+		exit(1);
+
+	/* One transaction for the registers, one block read per page */
+	for (i = 0; i < sizeof(ee) && ret == 0; i += ADM1166_PAGE_SIZE)
+		ret = adm1166_eeprom_read(&dev, ADM1166_EEPROM_BASE + i, ee + i);
+	if (ret == 0)
+		ret = adm1166_regs_read(&dev, 0, live, sizeof(live));
+	adm1166_close(&dev);
+	if (ret < 0)
+		exit(1);
+
+	n = adm1166_drift(live, ee, NULL, d);
+	for (i = 0; i < n; i++)
+		adm1166_drift_print(stdout, "", &d[i]);
+	if (n == 0) {
+		printf("No drift\n");
+		return 0;
+	}
+	printf("%u registers differ from the EEPROM\n", n);
+
+	return 2;
+}
@@ -0,0 +1,325 @@
+/*
+ * Copyright (C) 2015-2016 Analog Devices, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * */
+
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "adm1166.h"
+
+#define NF	ADM1166_SIG_FEATURES
+
+struct fleet {
+	char **ids;
+	float *rows;
+	unsigned int num;
+	unsigned int size;
+};
+
+static int signature_from_log(const char *id, const char *path)
+{
+	struct adm1166_sample *samples = NULL, *tmp;
+	struct adm1166_signature sig;
+	unsigned int n = 0, size = 0, i;
+	char line[256];
+	FILE *f;
+
+	f = fopen(path, "r");
+	if (f == NULL) {
+		perror("Failed to open log file");
+		return -1;
+	}
+
+	while (fgets(line, sizeof(line), f)) {
+		if (line[0] == '#')
+			continue;
+		if (n == size) {
+			size = size ? size * 2 : 1024;
+			tmp = realloc(samples, size * sizeof(*samples));
+			if (tmp == NULL) {
+				free(samples);
+				fclose(f);
+				return -ENOMEM;
+			}
+			samples = tmp;
+		}
+		if (adm1166_sample_parse(line, &samples[n]) == 0)
+			n++;
+	}
+	fclose(f);
+
+	adm1166_signature_compute(samples, n, &sig);
+	free(samples);
+
+	printf("%s", id);
+	for (i = 0; i < NF; i++)
+		printf(" %g", sig.f[i]);
+	printf("\n");
+
+	return 0;
+}
+
+static int fleet_load(struct fleet *fleet, const char *path)
+{
+	char *line = NULL, *p, *end, *id;
+	size_t len = 0;
+	unsigned int i;
+	void *tmp;
+	FILE *f;
+
+	f = fopen(path, "r");
+	if (f == NULL) {
+		perror("Failed to open signature file");
+		return -1;
+	}
+
+	while (getline(&line, &len, f) > 0) {
+		if (line[0] == '#' || line[0] == '\n')
+			continue;
+
+		if (fleet->num == fleet->size) {
+			fleet->size = fleet->size ? fleet->size * 2 : 1024;
+			tmp = realloc(fleet->ids, fleet->size * sizeof(*fleet->ids));
+			if (tmp == NULL)
+				break;
+			fleet->ids = tmp;
+			tmp = realloc(fleet->rows, fleet->size * NF * sizeof(float));
+			if (tmp == NULL)
+				break;
+			fleet->rows = tmp;
+		}
+
+		p = line;
+		id = strsep(&p, " \t\n");
+		for (i = 0; i < NF && p; i++) {
+			fleet->rows[fleet->num * NF + i] = strtof(p, &end);
+			if (end == p)
+				break;
+			p = end;
+		}
+		if (i != NF) {
+			fprintf(stderr, "%s: invalid signature for %s\n", path, id);
+			continue;
+		}
+		fleet->ids[fleet->num++] = strdup(id);
+	}
+
+	free(line);
+	fclose(f);
+
+	return 0;
+}
+
+/* Wirth's selection, partially reorders v */
+static float select_nth(float *v, unsigned int n, unsigned int k)
+{
+	int lo = 0, hi = n - 1, i, j;
+	float pivot, t;
+
+	while (lo < hi) {
+		pivot = v[k];
+		i = lo;
+		j = hi;
+		do {
+			while (v[i] < pivot)
+				i++;
+			while (pivot < v[j])
+				j--;
+			if (i <= j) {
+				t = v[i];
+				v[i] = v[j];
+				v[j] = t;
+				i++;
+				j--;
+			}
+		} while (i <= j);
+		if (j < (int)k)
+			lo = i;
+		if ((int)k < i)
+			hi = j;
+	}
+
+	return v[k];
+}
+
+static float *scores;
+
+static int cmp_score(const void *a, const void *b)
+{
+	float x = scores[*(const unsigned int *)a];
+	float y = scores[*(const unsigned int *)b];
+
+	return (x < y) - (x > y);
+}
+
+/*
+ * Robust z-scores per feature (median and MAD over the fleet), a board's
+ * score is the RMS of its z-scores.  The matrix is transposed to one
+ * contiguous column per feature so the inner loops vectorize.
+ */
+static void fleet_rank(struct fleet *fleet, unsigned int top)
+{
+	unsigned int nb = fleet->num;
+	float *cols, *tmp, *z, *maxz;
+	unsigned int *maxf, *order, *used;
+	unsigned int b, f, cnt;
+	float med, scale, v;
+	char name[32];
+
+	cols = malloc(nb * NF * sizeof(float));
+	tmp = malloc(nb * sizeof(float));
+	z = malloc(nb * sizeof(float));
+	maxz = calloc(nb, sizeof(float));
+	scores = calloc(nb, sizeof(float));
+	maxf = calloc(nb, sizeof(unsigned int));
+	used = calloc(nb, sizeof(unsigned int));
+	order = malloc(nb * sizeof(unsigned int));
+	if (!cols || !tmp || !z || !maxz || !scores || !maxf || !used || !order)
+		goto out;
+
+	for (b = 0; b < nb; b++) {
+		for (f = 0; f < NF; f++)
+			cols[f * nb + b] = fleet->rows[b * NF + f];
+	}
+
+	for (f = 0; f < NF; f++) {
+		float *col = cols + f * nb;
+
+		for (b = 0, cnt = 0; b < nb; b++) {
+			if (!isnan(col[b]))
+				tmp[cnt++] = col[b];
+		}
+		if (cnt < 3)
+			continue;
+
+		med = select_nth(tmp, cnt, cnt / 2);
+		for (b = 0; b < cnt; b++)
+			tmp[b] = fabsf(tmp[b] - med);
+		scale = 1.4826f * select_nth(tmp, cnt, cnt / 2);
+		if (scale == 0) {
+			for (b = 0, v = 0; b < cnt; b++)
+				v += tmp[b];
+			scale = 1.2533f * v / cnt;
+		}
+		if (scale == 0)
+			continue;
+
+		for (b = 0; b < nb; b++)
+			z[b] = (col[b] - med) / scale;
+
+		for (b = 0; b < nb; b++) {
+			if (isnan(z[b]))
+				continue;
+			scores[b] += z[b] * z[b];
+			used[b]++;
+			if (fabsf(z[b]) > fabsf(maxz[b])) {
+				maxz[b] = z[b];
+				maxf[b] = f;
+			}
+		}
+	}
+
+	for (b = 0; b < nb; b++) {
+		scores[b] = used[b] ? sqrtf(scores[b] / used[b]) : 0;
+		order[b] = b;
+	}
+	qsort(order, nb, sizeof(*order), cmp_score);
+
+	printf("%-5s %-24s %8s %8s  %s\n", "Rank", "Board", "Score", "Max z",
+		"Feature");
+	for (b = 0; b < nb && b < top; b++) {
+		adm1166_signature_feature_name(maxf[order[b]], name, sizeof(name));
+		printf("%-5u %-24s %8.2f %+8.2f  %s\n", b + 1,
+			fleet->ids[order[b]], scores[order[b]], maxz[order[b]],
+			used[order[b]] ? name : "-");
+	}
+
+out:
+	free(cols);
+	free(tmp);
+	free(z);
+	free(maxz);
+	free(scores);
+	free(maxf);
+	free(used);
+	free(order);
+}
+
+static void usage(const char *name)
+{
+	printf("Usage: %s -s <board-id> <log-file>\n"
+		"       %s [-k <top>] <signature-file> [...]\n\n"
+		"The first form reduces a telemetry log to a one line board\n"
+		"signature.  The second ranks all boards of the signature files by\n"
+		"their robust z-score distance from the fleet.\n", name, name);
+}
+
+int main(int argc, char *argv[])
+{
+	struct fleet fleet = { NULL, NULL, 0, 0 };
+	const char *sig_id = NULL;
+	unsigned int top = 20;
+	struct timespec t0, t1;
+	int opt, i;
+
+	while ((opt = getopt(argc, argv, "k:s:")) != -1) {
+		switch (opt) {
+		case 'k':
+			top = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			sig_id = optarg;
+			break;
+		default:
+			usage(argv[0]);
+			exit(1);
+		}
+	}
+
+	if (optind == argc || (sig_id && optind + 1 != argc)) {
+		usage(argv[0]);
+		return 0;
+	}
+
+	if (sig_id)
+		return signature_from_log(sig_id, argv[optind]) < 0 ? 1 : 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (i = optind; i < argc; i++) {
+		if (fleet_load(&fleet, argv[i]) < 0)
+			exit(1);
+	}
+	if (fleet.num == 0) {
+		fprintf(stderr, "No signatures\n");
+		exit(1);
+	}
+
+	fleet_rank(&fleet, top);
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+
+	fprintf(stderr, "Ranked %u boards in %.1f ms\n", fleet.num,
+		(t1.tv_sec - t0.tv_sec) * 1e3 + (t1.tv_nsec - t0.tv_nsec) / 1e6);
+
+	for (i = 0; i < (int)fleet.num; i++)
+		free(fleet.ids[i]);
+	free(fleet.ids);
+	free(fleet.rows);
+
+	return 0;
+}
@@ -0,0 +1,512 @@
+/*
+ * Copyright (C) 2015-2016 Analog Devices, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * */
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "adm1166.h"
+
+#define NP		ADM1166_NUM_PAGES
+#define FULL_MASK	0xffffffffu
+
+/*
+ * A library image is described by one FNV-1a hash per page over the bytes
+ * it supplies.  The user EEPROM, its checksum and the reserved pages are
+ * left out, the programmer never makes them match the image.
+ */
+struct entry {
+	uint64_t hash;
+	uint32_t mask;
+	unsigned int page;
+	unsigned int img;
+	int next;
+};
+
+struct library {
+	char **paths;
+	unsigned int *touched;
+	unsigned int num;
+	struct entry *entries;
+	unsigned int num_entries;
+	int *buckets;
+	unsigned int num_buckets;
+	/* Distinct byte masks seen per page, almost always just FULL_MASK */
+	uint32_t *masks[NP];
+	unsigned int num_masks[NP];
+};
+
+static int page_hashed(unsigned int page)
+{
+	unsigned int addr = ADM1166_EEPROM_BASE + page * ADM1166_PAGE_SIZE;
+
+	return !adm1166_page_reserved(addr) &&
+		!(addr >= ADM1166_USER_BASE && addr < ADM1166_SE_BASE);
+}
+
+static int byte_hashed(unsigned int off)
+{
+	unsigned int addr = ADM1166_EEPROM_BASE + off;
+
+	return addr != ADM1166_EE_USER_CSUM && addr != ADM1166_EE_USER_CSUM + 1;
+}
+
+static uint32_t page_mask(const struct adm1166_image *img, unsigned int page)
+{
+	unsigned int off = page * ADM1166_PAGE_SIZE, i;
+	uint32_t mask = 0;
+
+	for (i = 0; i < ADM1166_PAGE_SIZE; i++) {
+		if (adm1166_image_valid(img, off + i) && byte_hashed(off + i))
+			mask |= 1u << i;
+	}
+
+	return mask;
+}
+
+static uint64_t page_hash(const unsigned char *data, unsigned int page,
+	uint32_t mask)
+{
+	uint64_t h = 0xcbf29ce484222325ull;
+	unsigned int i;
+
+	data += page * ADM1166_PAGE_SIZE;
+	for (i = 0; i < ADM1166_PAGE_SIZE; i++) {
+		if (!(mask & (1u << i)))
+			continue;
+		h ^= data[i];
+		h *= 0x100000001b3ull;
+	}
+
+	return h;
+}
+
+static int index_build(const char *index, char * const *paths, int num)
+{
+	struct adm1166_image img;
+	unsigned int page;
+	uint32_t mask;
+	FILE *f;
+	int i;
+
+	f = fopen(index, "w");
+	if (f == NULL) {
+		perror("Failed to create index");
+		return -errno;
+	}
+
+	fprintf(f, "# adm1166_ident index, <image> followed by one "
+		"<hash>[/<mask>] or - per page\n");
+	for (i = 0; i < num; i++) {
+		if (adm1166_image_load(&img, paths[i]) < 0)
+			continue;
+		fprintf(f, "%s", paths[i]);
+		for (page = 0; page < NP; page++) {
+			mask = page_hashed(page) ? page_mask(&img, page) : 0;
+			if (mask == 0)
+				fprintf(f, " -");
+			else if (mask == FULL_MASK)
+				fprintf(f, " %016llx", (unsigned long long)
+					page_hash(img.data, page, mask));
+			else
+				fprintf(f, " %016llx/%08x", (unsigned long long)
+					page_hash(img.data, page, mask), mask);
+		}
+		fprintf(f, "\n");
+	}
+
+	if (fclose(f)) {
+		perror("Failed to write index");
+		return -errno;
+	}
+
+	return 0;
+}
+
+static int library_add_mask(struct library *lib, unsigned int page,
+	uint32_t mask)
+{
+	unsigned int i;
+	void *tmp;
+
+	for (i = 0; i < lib->num_masks[page]; i++) {
+		if (lib->masks[page][i] == mask)
+			return 0;
+	}
+
+	tmp = realloc(lib->masks[page], (i + 1) * sizeof(uint32_t));
+	if (tmp == NULL)
+		return -ENOMEM;
+	lib->masks[page] = tmp;
+	lib->masks[page][lib->num_masks[page]++] = mask;
+
+	return 0;
+}
+
+static unsigned int bucket_of(const struct library *lib, uint64_t hash,
+	unsigned int page)
+{
+	return (hash ^ (hash >> 32) ^ page) & (lib->num_buckets - 1);
+}
+
+static int library_load(struct library *lib, const char *index)
+{
+	char *line = NULL, *p, *tok, *end;
+	unsigned int page, size = 0, esize = 0, i;
+	struct entry *e;
+	size_t len = 0;
+	void *tmp;
+	FILE *f;
+
+	f = fopen(index, "r");
+	if (f == NULL) {
+		perror("Failed to open index");
+		return -errno;
+	}
+
+	while (getline(&line, &len, f) > 0) {
+		if (line[0] == '#' || line[0] == '\n')
+			continue;
+
+		if (lib->num == size) {
+			size = size ? size * 2 : 1024;
+			tmp = realloc(lib->paths, size * sizeof(*lib->paths));
+			if (tmp == NULL)
+				goto nomem;
+			lib->paths = tmp;
+			tmp = realloc(lib->touched, size * sizeof(*lib->touched));
+			if (tmp == NULL)
+				goto nomem;
+			lib->touched = tmp;
+		}
+		if (lib->num_entries + NP > esize) {
+			esize = esize ? esize * 2 : 1024 * NP;
+			tmp = realloc(lib->entries, esize * sizeof(*lib->entries));
+			if (tmp == NULL)
+				goto nomem;
+			lib->entries = tmp;
+		}
+
+		p = line;
+		lib->paths[lib->num] = strdup(strsep(&p, " \t\n"));
+		lib->touched[lib->num] = 0;
+		for (page = 0; page < NP; page++) {
+			tok = strsep(&p, " \t\n");
+			if (tok == NULL || *tok == '\0')
+				break;
+			if (*tok == '-')
+				continue;
+			e = &lib->entries[lib->num_entries];
+			e->hash = strtoull(tok, &end, 16);
+			e->mask = *end == '/' ? strtoul(end + 1, NULL, 16) :
+				FULL_MASK;
+			e->page = page;
+			e->img = lib->num;
+			if (library_add_mask(lib, page, e->mask) < 0)
+				goto nomem;
+			lib->touched[lib->num]++;
+			lib->num_entries++;
+		}
+		if (page != NP) {
+			fprintf(stderr, "%s: invalid entry for %s\n", index,
+				lib->paths[lib->num]);
+			lib->num_entries -= lib->touched[lib->num];
+			free(lib->paths[lib->num]);
+			continue;
+		}
+		lib->num++;
+	}
+	free(line);
+	fclose(f);
+
+	for (lib->num_buckets = 1; lib->num_buckets < 2 * lib->num_entries; )
+		lib->num_buckets <<= 1;
+	lib->buckets = malloc(lib->num_buckets * sizeof(int));
+	if (lib->buckets == NULL)
+		return -ENOMEM;
+	memset(lib->buckets, 0xff, lib->num_buckets * sizeof(int));
+
+	for (i = 0; i < lib->num_entries; i++) {
+		e = &lib->entries[i];
+		page = bucket_of(lib, e->hash, e->page);
+		e->next = lib->buckets[page];
+		lib->buckets[page] = i;
+	}
+
+	return 0;
+
+nomem:
+	free(line);
+	fclose(f);
+	return -ENOMEM;
+}
+
+static void library_free(struct library *lib)
+{
+	unsigned int i;
+
+	for (i = 0; i < lib->num; i++)
+		free(lib->paths[i]);
+	for (i = 0; i < NP; i++)
+		free(lib->masks[i]);
+	free(lib->paths);
+	free(lib->touched);
+	free(lib->entries);
+	free(lib->buckets);
+}
+
+/* Number of pages of each library image that match the snapshot */
+static void library_match(const struct library *lib,
+	const struct adm1166_image *snap, unsigned int *matched)
+{
+	const struct entry *e;
+	unsigned int page, m;
+	uint64_t h;
+	int i;
+
+	memset(matched, 0x00, lib->num * sizeof(*matched));
+
+	for (page = 0; page < NP; page++) {
+		for (m = 0; m < lib->num_masks[page]; m++) {
+			h = page_hash(snap->data, page, lib->masks[page][m]);
+			for (i = lib->buckets[bucket_of(lib, h, page)]; i >= 0;
+			     i = e->next) {
+				e = &lib->entries[i];
+				if (e->hash == h && e->page == page &&
+				    e->mask == lib->masks[page][m])
+					matched[e->img]++;
+			}
+		}
+	}
+}
+
+static const struct library *rank_lib;
+static const unsigned int *rank_matched;
+
+/* Most matching pages first, then fewest mismatching ones */
+static int cmp_rank(const void *a, const void *b)
+{
+	unsigned int x = *(const unsigned int *)a, y = *(const unsigned int *)b;
+	int mx = rank_lib->touched[x] - rank_matched[x];
+	int my = rank_lib->touched[y] - rank_matched[y];
+
+	if (rank_matched[x] != rank_matched[y])
+		return rank_matched[x] < rank_matched[y] ? 1 : -1;
+	if (mx != my)
+		return mx - my;
+	return x < y ? -1 : x > y;
+}
+
+static unsigned long long se_raw(const unsigned char *buf)
+{
+	unsigned long long v = 0;
+	int i;
+
+	for (i = 7; i >= 0; i--)
+		v = (v << 8) | buf[i];
+
+	return v;
+}
+
+static void print_se_diff(unsigned int n, const unsigned char *a,
+	const unsigned char *b)
+{
+	struct adm1166_se_state x, y;
+
+	adm1166_se_decode(a, &x);
+	adm1166_se_decode(b, &y);
+
+	if (x.pdo != y.pdo)
+		printf("  state %-2u PDO           %03x -> %03x\n", n, x.pdo, y.pdo);
+	if (x.monitor_mask != y.monitor_mask)
+		printf("  state %-2u monitor mask  %03x -> %03x\n", n,
+			x.monitor_mask, y.monitor_mask);
+	if (x.seq_sel != y.seq_sel)
+		printf("  state %-2u sequence      %u -> %u\n", n, x.seq_sel,
+			y.seq_sel);
+	if (x.timer != y.timer)
+		printf("  state %-2u timer         %u -> %u\n", n, x.timer, y.timer);
+	if (x.next_monitor != y.next_monitor)
+		printf("  state %-2u monitor next  %u -> %u\n", n,
+			x.next_monitor, y.next_monitor);
+	if (x.next_timeout != y.next_timeout)
+		printf("  state %-2u timeout next  %u -> %u\n", n,
+			x.next_timeout, y.next_timeout);
+	if (x.next_seq != y.next_seq)
+		printf("  state %-2u sequence next %u -> %u\n", n, x.next_seq,
+			y.next_seq);
+
+	/* Only unused bits differ */
+	if (memcmp(&x, &y, sizeof(x)) == 0)
+		printf("  state %-2u raw           %016llx -> %016llx\n", n,
+			se_raw(a), se_raw(b));
+}
+
+/* Registers the board differs in from the image, over the hashed bytes */
+static unsigned int print_diff(const struct adm1166_image *img,
+	const struct adm1166_image *snap)
+{
+	unsigned int page, off, i, n, diffs = 0;
+	uint32_t mask;
+
+	for (page = 0; page < NP; page++) {
+		if (!page_hashed(page))
+			continue;
+		mask = page_mask(img, page);
+		for (i = 0; i < ADM1166_PAGE_SIZE; i++) {
+			off = page * ADM1166_PAGE_SIZE + i;
+			if (!(mask & (1u << i)) || img->data[off] == snap->data[off])
+				continue;
+			diffs++;
+			if (ADM1166_EEPROM_BASE + off < ADM1166_SE_BASE) {
+				printf("  %4x %-18s %02x -> %02x\n",
+					ADM1166_EEPROM_BASE + off,
+					adm1166_eeprom_name(ADM1166_EEPROM_BASE + off),
+					img->data[off], snap->data[off]);
+				continue;
+			}
+			/* Report a state once, at its first differing byte */
+			n = (ADM1166_EEPROM_BASE + off - ADM1166_SE_BASE) / 8;
+			print_se_diff(n, img->data + off - off % 8,
+				snap->data + off - off % 8);
+			i += 7 - off % 8;
+		}
+	}
+
+	return diffs;
+}
+
+static int snapshot(const char *source, struct adm1166_image *snap)
+{
+	struct adm1166 dev;
+	int ret;
+
+	if (adm1166_source_is_image(source))
+		return adm1166_image_load(snap, source);
+
+	ret = adm1166_open_target(&dev, source);
+	if (ret < 0)
+		return ret;
+	ret = adm1166_image_read(&dev, snap);
+	adm1166_close(&dev);
+
+	return ret;
+}
+
+static void usage(const char *name)
+{
+	printf("Usage: %s -b <index> <image> [...]\n"
+		"       %s [-k <top>] <index> <target|image>\n\n"
+		"The first form indexes a library of configuration images.  The\n"
+		"second reads the board's EEPROM, ranks the library images by the\n"
+		"number of pages that match it and lists the registers in which the\n"
+		"board differs from the closest one.  The user EEPROM is ignored.\n",
+		name, name);
+}
+
+int main(int argc, char *argv[])
+{
+	struct library lib;
+	struct adm1166_image snap, img;
+	struct timespec t0, t1, t2;
+	unsigned int *matched = NULL, *order = NULL;
+	unsigned int top = 3, hashed = 0, i;
+	const char *build = NULL;
+	int opt, ret = 0;
+
+	while ((opt = getopt(argc, argv, "b:k:")) != -1) {
+		switch (opt) {
+		case 'b':
+			build = optarg;
+			break;
+		case 'k':
+			top = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+			exit(1);
+		}
+	}
+
+	if (build) {
+		if (optind == argc) {
+			usage(argv[0]);
+			return 0;
+		}
+		return index_build(build, argv + optind, argc - optind) < 0;
+	}
+
+	if (optind + 2 != argc) {
+		usage(argv[0]);
+		return 0;
+	}
+
+	if (snapshot(argv[optind + 1], &snap) < 0) {
+		fprintf(stderr, "Failed to read %s\n", argv[optind + 1]);
+		exit(1);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	memset(&lib, 0x00, sizeof(lib));
+	if (library_load(&lib, argv[optind]) < 0 || lib.num == 0) {
+		fprintf(stderr, "No images in %s\n", argv[optind]);
+		exit(1);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+
+	matched = malloc(lib.num * sizeof(*matched));
+	order = malloc(lib.num * sizeof(*order));
+	if (matched == NULL || order == NULL) {
+		ret = 1;
+		goto out;
+	}
+	library_match(&lib, &snap, matched);
+	for (i = 0; i < lib.num; i++)
+		order[i] = i;
+	rank_lib = &lib;
+	rank_matched = matched;
+	qsort(order, lib.num, sizeof(*order), cmp_rank);
+	clock_gettime(CLOCK_MONOTONIC, &t2);
+
+	for (i = 0; i < NP; i++)
+		hashed += page_hashed(i);
+
+	printf("%-5s %-40s %s\n", "Rank", "Image", "Pages");
+	for (i = 0; i < lib.num && i < top; i++)
+		printf("%-5u %-40s %u/%u\n", i + 1, lib.paths[order[i]],
+			matched[order[i]], lib.touched[order[i]]);
+
+	if (adm1166_image_load(&img, lib.paths[order[0]]) == 0) {
+		printf("\nDifferences from %s:\n", lib.paths[order[0]]);
+		if (print_diff(&img, &snap) == 0)
+			printf("  none, exact match over %u pages\n", hashed);
+	}
+
+	fprintf(stderr, "Loaded %u images in %.1f ms, matched in %.2f ms\n",
+		lib.num,
+		(t1.tv_sec - t0.tv_sec) * 1e3 + (t1.tv_nsec - t0.tv_nsec) / 1e6,
+		(t2.tv_sec - t1.tv_sec) * 1e3 + (t2.tv_nsec - t1.tv_nsec) / 1e6);
+
+out:
+	free(matched);
+	free(order);
+	library_free(&lib);
+
+	return ret;
+}
@@ -0,0 +1,405 @@
+/*
+ * Copyright (C) 2015-2016 Analog Devices, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "adm1166.h"
+
+#define MAX_RAILS	ADM1166_NUM_SFDS
+#define STEADY_MS	100
+
+struct fault_rail {
+	unsigned int sfd;
+	unsigned int dac;
+	unsigned char code;
+};
+
+struct latency_sample {
+	unsigned int sfd;
+	unsigned int from_state;
+	unsigned int fault_state;
+	long state_us;
+	long pdo_us;
+	unsigned int poll_us;
+};
+
+static struct fault_rail rails[MAX_RAILS];
+static unsigned int num_rails;
+static struct latency_sample *samples;
+static unsigned int num_samples;
+static unsigned int timeout_ms = 1000;
+
+static unsigned long long now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+static int read_status(struct adm1166 *dev, unsigned int *state,
+	unsigned int *pdo)
+{
+	unsigned char buf[3];
+	int ret;
+
+	/* PDOSTAT1, PDOSTAT2 and SESTATE are adjacent, one transaction */
+	ret = adm1166_regs_read(dev, ADM1166_REG_PDOSTAT1, buf, 3);
+	if (ret < 0)
+		return ret;
+
+	*pdo = buf[0] | (buf[1] << 8);
+	*state = buf[2];
+
+	return 0;
+}
+
+static int wait_steady(struct adm1166 *dev, unsigned int *state,
+	unsigned int *pdo)
+{
+	unsigned long long start = now_us(), since;
+	unsigned int s, p;
+	int ret;
+
+	ret = read_status(dev, state, pdo);
+	if (ret < 0)
+		return ret;
+	since = now_us();
+
+	while (now_us() - start < timeout_ms * 1000ULL) {
+		usleep(1000);
+		ret = read_status(dev, &s, &p);
+		if (ret < 0)
+			return ret;
+		if (s != *state || p != *pdo) {
+			*state = s;
+			*pdo = p;
+			since = now_us();
+		} else if (now_us() - since >= STEADY_MS * 1000) {
+			return 0;
+		}
+	}
+
+	return -ETIMEDOUT;
+}
+
+static int parse_rail(char *arg, struct fault_rail *rail)
+{
+	char *name, *dac, *code;
+	int ch;
+
+	name = strsep(&arg, ":");
+	dac = strsep(&arg, ":");
+	code = strsep(&arg, ":");
+	if (code == NULL || arg != NULL)
+		return -1;
+
+	ch = adm1166_adc_channel_by_name(name);
+	if (ch < 0 || ch >= ADM1166_NUM_SFDS)
+		return -1;
+
+	rail->sfd = ch;
+	rail->dac = strtoul(dac, NULL, 0);
+	rail->code = strtoul(code, NULL, 0);
+	if (rail->dac < 1 || rail->dac > ADM1166_NUM_DACS)
+		return -1;
+
+	return 0;
+}
+
+static int measure(struct adm1166 *dev, struct fault_rail *rail,
+	struct latency_sample *sample)
+{
+	unsigned char ctrl, code, dplim, dnlim, lo, hi;
+	unsigned long long t, start, first = 0, last = 0;
+	unsigned int base_state, base_pdo, state, pdo;
+	unsigned int polls = 0;
+	int ret;
+
+	ret = wait_steady(dev, &base_state, &base_pdo);
+	if (ret < 0) {
+		fprintf(stderr, "Sequencer did not settle\n");
+		return ret;
+	}
+
+	adm1166_sim_couple(dev, rail->dac, rail->sfd);
+
+	ret = adm1166_reg_read(dev, ADM1166_REG_DACCTRL(rail->dac), &ctrl);
+	if (ret == 0)
+		ret = adm1166_reg_read(dev, ADM1166_REG_DAC(rail->dac), &code);
+	if (ret == 0)
+		ret = adm1166_reg_read(dev, ADM1166_REG_DPLIM(rail->dac), &dplim);
+	if (ret == 0)
+		ret = adm1166_reg_read(dev, ADM1166_REG_DNLIM(rail->dac), &dnlim);
+	if (ret < 0)
+		return ret;
+
+	/* Open the clamps just enough for the midcode and the fault code */
+	lo = rail->code < ADM1166_DAC_MIDCODE ? rail->code : ADM1166_DAC_MIDCODE;
+	hi = rail->code > ADM1166_DAC_MIDCODE ? rail->code : ADM1166_DAC_MIDCODE;
+	if (dplim >= dnlim) {
+		lo = dnlim < lo ? dnlim : lo;
+		hi = dplim > hi ? dplim : hi;
+	}
+
+	ret = adm1166_reg_write(dev, ADM1166_REG_DPLIM(rail->dac), hi);
+	if (ret == 0)
+		ret = adm1166_reg_write(dev, ADM1166_REG_DNLIM(rail->dac), lo);
+	if (ret == 0)
+		ret = adm1166_reg_write(dev, ADM1166_REG_DAC(rail->dac),
+			ADM1166_DAC_MIDCODE);
+	if (ret == 0)
+		ret = adm1166_reg_write(dev, ADM1166_REG_DACCTRL(rail->dac),
+			ctrl | ADM1166_DACCTRL_ENABLE);
+	if (ret < 0)
+		goto restore;
+
+	memset(sample, 0x00, sizeof(*sample));
+	sample->sfd = rail->sfd;
+	sample->from_state = base_state;
+	sample->fault_state = base_state;
+	sample->state_us = -1;
+	sample->pdo_us = -1;
+
+	ret = adm1166_reg_write(dev, ADM1166_REG_DAC(rail->dac), rail->code);
+	start = now_us();
+	if (ret < 0)
+		goto restore;
+
+	do {
+		ret = read_status(dev, &state, &pdo);
+		t = now_us();
+		if (ret < 0)
+			goto restore;
+		if (polls++ == 0)
+			first = t;
+		last = t;
+
+		if (sample->state_us < 0 && state != base_state) {
+			sample->state_us = t - start;
+			sample->fault_state = state;
+		}
+		if (sample->pdo_us < 0 && pdo != base_pdo)
+			sample->pdo_us = t - start;
+	} while ((sample->state_us < 0 || sample->pdo_us < 0) &&
+		 t - start < timeout_ms * 1000ULL);
+
+	sample->poll_us = polls > 1 ? (last - first) / (polls - 1) : 0;
+
+restore:
+	adm1166_reg_write(dev, ADM1166_REG_DAC(rail->dac), code);
+	adm1166_reg_write(dev, ADM1166_REG_DACCTRL(rail->dac), ctrl);
+	adm1166_reg_write(dev, ADM1166_REG_DNLIM(rail->dac), dnlim);
+	adm1166_reg_write(dev, ADM1166_REG_DPLIM(rail->dac), dplim);
+
+	return ret;
+}
+
+static int cmp_long(const void *a, const void *b)
+{
+	long x = *(const long *)a, y = *(const long *)b;
+
+	return (x > y) - (x < y);
+}
+
+static void print_dist(long *v, unsigned int n)
+{
+	qsort(v, n, sizeof(*v), cmp_long);
+	printf(" %7ld %7ld %7ld %7ld %7ld", v[0], v[n / 2], v[(n - 1) * 90 / 100],
+		v[(n - 1) * 99 / 100], v[n - 1]);
+}
+
+static void print_dist_header(void)
+{
+	printf(" %7s %7s %7s %7s %7s", "min", "p50", "p90", "p99", "max");
+}
+
+/* One row per rail, state it started from and state it faulted into */
+static void report(void)
+{
+	long *state_us, *pdo_us;
+	unsigned int i, j, n, nstate, npdo, poll;
+	unsigned char *done;
+
+	state_us = calloc(num_samples, sizeof(*state_us));
+	pdo_us = calloc(num_samples, sizeof(*pdo_us));
+	done = calloc(num_samples, 1);
+	if (!state_us || !pdo_us || !done)
+		goto out;
+
+	printf("%-23s  %-39s  %s\n", "", "PDO latency us",
+		"State latency us");
+	printf("%-5s %5s %5s %5s ", "Rail", "From", "Fault", "Count");
+	print_dist_header();
+	printf(" ");
+	print_dist_header();
+	printf("\n");
+
+	for (i = 0; i < num_samples; i++) {
+		if (done[i])
+			continue;
+
+		n = nstate = npdo = poll = 0;
+		for (j = i; j < num_samples; j++) {
+			if (samples[j].sfd != samples[i].sfd ||
+			    samples[j].from_state != samples[i].from_state ||
+			    samples[j].fault_state != samples[i].fault_state)
+				continue;
+			done[j] = 1;
+			n++;
+			poll += samples[j].poll_us;
+			if (samples[j].state_us >= 0)
+				state_us[nstate++] = samples[j].state_us;
+			if (samples[j].pdo_us >= 0)
+				pdo_us[npdo++] = samples[j].pdo_us;
+		}
+
+		printf("%-5s %5u ", adm1166_adc_channel_name(samples[i].sfd),
+			samples[i].from_state);
+		if (nstate)
+			printf("%5u", samples[i].fault_state);
+		else
+			printf("%5s", "none");
+		printf(" %5u ", n);
+		if (npdo)
+			print_dist(pdo_us, npdo);
+		else
+			printf(" %39s", "no PDO change");
+		printf(" ");
+		if (nstate)
+			print_dist(state_us, nstate);
+		else
+			printf(" %39s", "no state change");
+		printf("  (poll %u us)\n", poll / n);
+	}
+
+out:
+	free(state_us);
+	free(pdo_us);
+	free(done);
+}
+
+static void usage(const char *name)
+{
+	printf("Usage: %s [-n <iterations>] [-t <timeout-ms>] [-p <power-cycle-command>]\n"
+		"\t[-o <samples-file>] -r <rail>:<dac>:<code> [-r ...] <target>\n\n"
+		"Steps the margining DAC of each rail to <code>, pushing it out of\n"
+		"its fault window, and measures how long the sequencer takes to\n"
+		"change state and PDO outputs.  Between measurements the board is\n"
+		"power cycled with <power-cycle-command>, simulated targets (\"sim\")\n"
+		"are reset directly.\n", name);
+}
+
+int main(int argc, char *argv[])
+{
+	const char *power_cmd = NULL;
+	const char *out_path = NULL;
+	unsigned int iterations = 1;
+	unsigned int i, r;
+	struct adm1166 dev;
+	FILE *out;
+	int ret = 0;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "n:o:p:r:t:")) != -1) {
+		switch (opt) {
+		case 'n':
+			iterations = strtoul(optarg, NULL, 0);
+			break;
+		case 'o':
+			out_path = optarg;
+			break;
+		case 'p':
+			power_cmd = optarg;
+			break;
+		case 'r':
+			if (num_rails == MAX_RAILS ||
+			    parse_rail(optarg, &rails[num_rails]) < 0) {
+				fprintf(stderr, "Invalid rail \"%s\"\n", optarg);
+				exit(1);
+			}
+			num_rails++;
+			break;
+		case 't':
+			timeout_ms = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+			exit(1);
+		}
+	}
+
+	if (num_rails == 0 || iterations == 0 || optind + 1 != argc) {
+		usage(argv[0]);
+		return 0;
+	}
+
+	samples = calloc(iterations * num_rails, sizeof(*samples));
+	if (samples == NULL)
+		exit(1);
+
+	if (adm1166_open_target(&dev, argv[optind]) < 0)
+		exit(1);
+
+	for (i = 0; i < iterations && ret == 0; i++) {
+		for (r = 0; r < num_rails && ret == 0; r++) {
+			if (num_samples > 0 &&
+			    adm1166_sim_power_cycle(&dev) == -ENODEV) {
+				if (power_cmd == NULL) {
+					printf("No power cycle command, stopping after one measurement.\n");
+					ret = 1;
+					break;
+				}
+				if (system(power_cmd) != 0) {
+					fprintf(stderr, "Power cycle command failed\n");
+					ret = 1;
+					break;
+				}
+			}
+
+			ret = measure(&dev, &rails[r], &samples[num_samples]);
+			if (ret == 0)
+				num_samples++;
+		}
+	}
+
+	adm1166_close(&dev);
+
+	if (out_path) {
+		out = fopen(out_path, "w");
+		if (out == NULL) {
+			perror("Failed to create samples file");
+			exit(1);
+		}
+		fprintf(out, "# rail from_state fault_state pdo_us state_us poll_us\n");
+		for (i = 0; i < num_samples; i++)
+			fprintf(out, "%s %u %u %ld %ld %u\n",
+				adm1166_adc_channel_name(samples[i].sfd),
+				samples[i].from_state, samples[i].fault_state,
+				samples[i].pdo_us, samples[i].state_us,
+				samples[i].poll_us);
+		fclose(out);
+	}
+
+	if (num_samples)
+		report();
+
+	return num_samples ? 0 : 1;
+}
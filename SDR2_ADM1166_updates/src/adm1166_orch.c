@@ -0,0 +1,442 @@
+/*
+ * Copyright (C) 2015-2016 Analog Devices, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * */
+
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "adm1166.h"
+#include "proto.h"
+
+#define MAX_CALLS	3
+
+enum action {
+	ACTION_PROGRAM,
+	ACTION_PLAN,
+	ACTION_VERIFY,
+	ACTION_SNAPSHOT,
+	ACTION_TELEMETRY,
+};
+
+struct agent {
+	const char *spec;
+	int fd;
+	struct proto_buf in;
+	unsigned int types[MAX_CALLS];
+	unsigned int num_calls;
+	unsigned int replies;
+	unsigned long long t0;
+	int failed;
+};
+
+static struct {
+	enum action action;
+	struct adm1166_image image;
+	unsigned int flags;
+	unsigned int samples;
+	unsigned int interval_ms;
+	const char *prefix;
+	unsigned int timeout_ms;
+} orch;
+
+static unsigned long long now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000;
+}
+
+static int call(struct proto_buf *out, struct agent *a, unsigned int type,
+	const struct proto_buf *args)
+{
+	struct proto_buf b = { NULL, 0, 0 };
+	int ret;
+
+	a->types[a->num_calls++] = type;
+	ret = proto_put_varint(&b, a->num_calls);
+	if (ret == 0)
+		ret = proto_put_bytes(&b, args->data, args->len);
+	if (ret == 0)
+		ret = proto_frame(out, type, b.data, b.len);
+	proto_buf_free(&b);
+
+	return ret;
+}
+
+/* The whole batch goes out at once, the agent answers in order */
+static int agent_start(struct agent *a)
+{
+	struct proto_buf out = { NULL, 0, 0 }, img = { NULL, 0, 0 };
+	struct proto_buf args = { NULL, 0, 0 };
+	int ret = 0;
+
+	a->t0 = now_ms();
+	a->fd = proto_connect(a->spec, orch.timeout_ms);
+	if (a->fd < 0) {
+		printf("%s: failed to connect: %d\n", a->spec, -a->fd);
+		a->failed = 1;
+		return a->fd;
+	}
+
+	if (orch.action <= ACTION_VERIFY)
+		ret = adm1166_image_encode(&img, &orch.image);
+
+	switch (ret < 0 ? -1 : (int)orch.action) {
+	case ACTION_PROGRAM:
+		ret = proto_put_varint(&args, orch.flags);
+		if (ret == 0)
+			ret = call(&out, a, ADM1166_RPC_PLAN, &img);
+		if (ret == 0)
+			ret = call(&out, a, ADM1166_RPC_PROGRAM, &args);
+		if (ret == 0)
+			ret = call(&out, a, ADM1166_RPC_VERIFY, &img);
+		break;
+	case ACTION_PLAN:
+		ret = call(&out, a, ADM1166_RPC_PLAN, &img);
+		break;
+	case ACTION_VERIFY:
+		ret = call(&out, a, ADM1166_RPC_VERIFY, &img);
+		break;
+	case ACTION_SNAPSHOT:
+		ret = call(&out, a, ADM1166_RPC_SNAPSHOT, &args);
+		break;
+	case ACTION_TELEMETRY:
+		ret = proto_put_varint(&args, orch.samples);
+		if (ret == 0)
+			ret = proto_put_varint(&args, orch.interval_ms);
+		if (ret == 0)
+			ret = call(&out, a, ADM1166_RPC_TELEMETRY, &args);
+		break;
+	}
+
+	if (ret == 0)
+		ret = proto_send_all(a->fd, out.data, out.len);
+	proto_buf_free(&out);
+	proto_buf_free(&img);
+	proto_buf_free(&args);
+	if (ret < 0) {
+		printf("%s: failed to send: %d\n", a->spec, -ret);
+		close(a->fd);
+		a->fd = -1;
+		a->failed = 1;
+	}
+
+	return ret;
+}
+
+static void print_pages(struct agent *a, const unsigned char **p,
+	const unsigned char *end)
+{
+	unsigned long long n, addr;
+
+	if (proto_get_varint(p, end, &n) < 0)
+		return;
+	printf("%s: %llu pages to program", a->spec, n);
+	while (n-- && proto_get_varint(p, end, &addr) == 0)
+		printf(" %llx", addr);
+	printf("\n");
+}
+
+static void save_snapshot(struct agent *a, const unsigned char **p,
+	const unsigned char *end)
+{
+	struct adm1166_image img;
+	char path[256];
+	unsigned int i;
+	FILE *f;
+
+	if (adm1166_image_decode(p, end, &img) < 0) {
+		printf("%s: bad snapshot\n", a->spec);
+		a->failed = 1;
+		return;
+	}
+
+	printf("%s: device %02x configuration version %02x\n", a->spec,
+		img.data[ADM1166_EE_DEVICE_ID - ADM1166_EEPROM_BASE],
+		img.data[ADM1166_EE_CFG_VERSION - ADM1166_EEPROM_BASE]);
+	if (orch.prefix == NULL)
+		return;
+
+	snprintf(path, sizeof(path), "%s-%s.bin", orch.prefix, a->spec);
+	for (i = strlen(orch.prefix) + 1; path[i]; i++) {
+		if (path[i] == ':' || path[i] == '/')
+			path[i] = '-';
+	}
+	f = fopen(path, "wb");
+	if (f == NULL || fwrite(img.data, sizeof(img.data), 1, f) != 1) {
+		perror("Failed to write snapshot");
+		a->failed = 1;
+	}
+	if (f)
+		fclose(f);
+}
+
+static void print_samples(struct agent *a, const unsigned char *p,
+	const unsigned char *end)
+{
+	struct adm1166_sample *s;
+	int i, n;
+
+	s = malloc((orch.samples ? orch.samples : 1) * sizeof(*s));
+	if (s == NULL)
+		return;
+	n = adm1166_samples_decode(p, end - p, s, orch.samples);
+	for (i = 0; i < n; i++) {
+		printf("%s ", a->spec);
+		adm1166_sample_print(stdout, &s[i]);
+	}
+	if (n < 0) {
+		printf("%s: bad samples\n", a->spec);
+		a->failed = 1;
+	}
+	free(s);
+}
+
+static void handle_reply(struct agent *a, const unsigned char *p, size_t len)
+{
+	const unsigned char *end = p + len;
+	unsigned long long id, bad, first, pages;
+	long long status;
+
+	if (proto_get_varint(&p, end, &id) < 0 ||
+	    proto_get_svarint(&p, end, &status) < 0 ||
+	    id == 0 || id > a->num_calls) {
+		printf("%s: bad reply\n", a->spec);
+		a->failed = 1;
+		return;
+	}
+	a->replies++;
+
+	if (status < 0) {
+		printf("%s: call %llu failed: %lld\n", a->spec, id, -status);
+		a->failed = 1;
+		return;
+	}
+
+	switch (a->types[id - 1]) {
+	case ADM1166_RPC_PLAN:
+		print_pages(a, &p, end);
+		break;
+	case ADM1166_RPC_PROGRAM:
+		if (proto_get_varint(&p, end, &pages) == 0 && pages)
+			printf("%s: programmed %llu pages%s\n", a->spec, pages,
+				orch.flags & ADM1166_RPC_NO_ACTIVATE ?
+				", reboot to activate" : "");
+		break;
+	case ADM1166_RPC_VERIFY:
+		if (proto_get_varint(&p, end, &bad) < 0 ||
+		    proto_get_varint(&p, end, &first) < 0)
+			break;
+		if (bad) {
+			printf("%s: %llu bytes differ, first at %llx\n", a->spec,
+				bad, first);
+			a->failed = 1;
+		} else {
+			printf("%s: verified\n", a->spec);
+		}
+		break;
+	case ADM1166_RPC_SNAPSHOT:
+		save_snapshot(a, &p, end);
+		break;
+	case ADM1166_RPC_TELEMETRY:
+		print_samples(a, p, end);
+		break;
+	}
+}
+
+/* Returns 1 once every call has been answered or the agent went away */
+static int agent_read(struct agent *a)
+{
+	const unsigned char *payload;
+	unsigned char buf[65536];
+	unsigned int type;
+	size_t plen, off = 0;
+	ssize_t ret;
+	int flen;
+
+	ret = recv(a->fd, buf, sizeof(buf), 0);
+	if (ret <= 0 || proto_put_bytes(&a->in, buf, ret) < 0) {
+		printf("%s: connection lost\n", a->spec);
+		a->failed = 1;
+		return 1;
+	}
+
+	while ((flen = proto_next_frame(a->in.data + off, a->in.len - off,
+			&type, &payload, &plen)) > 0) {
+		if (type == ADM1166_RPC_REPLY)
+			handle_reply(a, payload, plen);
+		off += flen;
+	}
+	if (flen < 0) {
+		printf("%s: bad frame\n", a->spec);
+		a->failed = 1;
+		return 1;
+	}
+	memmove(a->in.data, a->in.data + off, a->in.len - off);
+	a->in.len -= off;
+
+	return a->replies == a->num_calls;
+}
+
+static void agent_done(struct agent *a)
+{
+	printf("%s: %s in %.2f s\n", a->spec, a->failed ? "FAILED" : "done",
+		(now_ms() - a->t0) / 1000.0);
+	fflush(stdout);
+	close(a->fd);
+	a->fd = -1;
+	proto_buf_free(&a->in);
+}
+
+static void usage(const char *name)
+{
+	printf("Usage: %s [-a program|plan|verify|snapshot|telemetry] [-j <jobs>]\n"
+		"       [-r] [-i <ihex-file>] [-o <prefix>] [-n <samples>]\n"
+		"       [-I <interval-ms>] <host:port>...\n\n"
+		"Drives adm1166_agent on many boards at once, at most <jobs> at a\n"
+		"time.  The calls for a board are sent in one pipelined batch:\n"
+		"program plans, programs and verifies <ihex-file>, -r leaves the\n"
+		"activation to the next reboot.  snapshot saves each EEPROM to\n"
+		"<prefix>-<host>-<port>.bin with -o, telemetry prints <samples>\n"
+		"samples per board.\n", name);
+}
+
+int main(int argc, char *argv[])
+{
+	const char *path = NULL, *action = "program";
+	unsigned int jobs = 32, next, active = 0, num, i, failed = 0;
+	struct agent *agents;
+	struct pollfd *pfds;
+	unsigned int *idx;
+	int opt;
+
+	orch.samples = 10;
+	orch.interval_ms = 100;
+	orch.timeout_ms = 5000;
+
+	while ((opt = getopt(argc, argv, "a:i:I:j:n:o:r")) != -1) {
+		switch (opt) {
+		case 'a':
+			action = optarg;
+			break;
+		case 'i':
+			path = optarg;
+			break;
+		case 'I':
+			orch.interval_ms = strtoul(optarg, NULL, 0);
+			break;
+		case 'j':
+			jobs = strtoul(optarg, NULL, 0);
+			break;
+		case 'n':
+			orch.samples = strtoul(optarg, NULL, 0);
+			break;
+		case 'o':
+			orch.prefix = optarg;
+			break;
+		case 'r':
+			orch.flags |= ADM1166_RPC_NO_ACTIVATE;
+			break;
+		default:
+			usage(argv[0]);
+			exit(1);
+		}
+	}
+
+	if (strcmp(action, "program") == 0)
+		orch.action = ACTION_PROGRAM;
+	else if (strcmp(action, "plan") == 0)
+		orch.action = ACTION_PLAN;
+	else if (strcmp(action, "verify") == 0)
+		orch.action = ACTION_VERIFY;
+	else if (strcmp(action, "snapshot") == 0)
+		orch.action = ACTION_SNAPSHOT;
+	else if (strcmp(action, "telemetry") == 0)
+		orch.action = ACTION_TELEMETRY;
+	else
+		jobs = 0;
+
+	if (optind >= argc || jobs == 0 ||
+	    (orch.action <= ACTION_VERIFY && path == NULL)) {
+		usage(argv[0]);
+		return 0;
+	}
+
+	if (path && adm1166_image_load(&orch.image, path) < 0) {
+		printf("Failed to parse ihex file \"%s\". Aborting.\n", path);
+		exit(1);
+	}
+
+	num = argc - optind;
+	agents = calloc(num, sizeof(*agents));
+	pfds = calloc(jobs, sizeof(*pfds));
+	idx = calloc(jobs, sizeof(*idx));
+	if (agents == NULL || pfds == NULL || idx == NULL)
+		exit(1);
+	for (i = 0; i < num; i++) {
+		agents[i].spec = argv[optind + i];
+		agents[i].fd = -1;
+	}
+	signal(SIGPIPE, SIG_IGN);
+
+	for (next = 0; next < num || active; ) {
+		while (active < jobs && next < num) {
+			if (agent_start(&agents[next]) < 0) {
+				agent_done(&agents[next++]);
+				continue;
+			}
+			pfds[active].fd = agents[next].fd;
+			pfds[active].events = POLLIN;
+			idx[active++] = next++;
+		}
+		if (active == 0)
+			break;
+
+		if (poll(pfds, active, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("poll");
+			exit(1);
+		}
+
+		for (i = 0; i < active; ) {
+			if (pfds[i].revents && agent_read(&agents[idx[i]])) {
+				agent_done(&agents[idx[i]]);
+				active--;
+				pfds[i] = pfds[active];
+				idx[i] = idx[active];
+				continue;
+			}
+			i++;
+		}
+	}
+
+	for (i = 0; i < num; i++)
+		failed += agents[i].failed;
+	if (num > 1)
+		printf("%u of %u boards failed\n", failed, num);
+	free(agents);
+	free(pfds);
+	free(idx);
+
+	return failed ? 1 : 0;
+}
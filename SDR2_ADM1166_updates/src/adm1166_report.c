@@ -0,0 +1,191 @@
+/*
+ * Copyright (C) 2015-2016 Analog Devices, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "adm1166.h"
+
+static const char *prefix;
+static unsigned int flags;
+static char *names[ADM1166_SE_STATES];
+
+/* State names from the "<<<n name >>>" lines of an ADM1166.txt export */
+static int load_names(const char *path)
+{
+	char line[256], *p, *end;
+	unsigned int n;
+	FILE *f;
+
+	f = fopen(path, "r");
+	if (f == NULL) {
+		perror("Failed to open names file");
+		return -errno;
+	}
+
+	while (fgets(line, sizeof(line), f)) {
+		p = strstr(line, "<<<");
+		if (p == NULL)
+			continue;
+		n = strtoul(p + 3, &p, 10);
+		end = strstr(p, " >>>");
+		if (n >= ADM1166_SE_STATES || *p != ' ' || end == NULL)
+			continue;
+		*end = '\0';
+		free(names[n]);
+		names[n] = strdup(p + 1);
+	}
+	fclose(f);
+
+	return 0;
+}
+
+static int report_source(const char *source)
+{
+	unsigned char regs[ADM1166_NUM_REGS];
+	struct adm1166_image img;
+	static char obuf[65536];
+	struct adm1166 dev;
+	FILE *f = stdout;
+	char path[256];
+	unsigned int i;
+	int image = adm1166_source_is_image(source);
+	int ret;
+
+	if (image) {
+		ret = adm1166_image_load(&img, source);
+		if (ret < 0)
+			return ret;
+	} else {
+		ret = adm1166_open_target(&dev, source);
+		if (ret < 0)
+			return ret;
+		ret = adm1166_image_read(&dev, &img);
+		if (ret == 0)
+			ret = adm1166_regs_read(&dev, 0, regs, sizeof(regs));
+		adm1166_close(&dev);
+		if (ret < 0)
+			return ret;
+	}
+
+	if (prefix) {
+		snprintf(path, sizeof(path), "%s-%s.txt", prefix, source);
+		for (i = strlen(prefix) + 1; path[i]; i++) {
+			if (path[i] == ':' || path[i] == '/')
+				path[i] = '-';
+		}
+		f = fopen(path, "w");
+		if (f == NULL) {
+			perror("Failed to create report file");
+			return -errno;
+		}
+		setvbuf(f, obuf, _IOFBF, sizeof(obuf));
+	}
+
+	adm1166_report(f, source, &img, image ? NULL : regs, names, flags);
+
+	if (f != stdout)
+		fclose(f);
+
+	return 0;
+}
+
+static void usage(const char *name)
+{
+	printf("Usage: %s [-p] [-j <jobs>] [-n <names>] [-o <prefix>]\n"
+		"       <ihex-file|target> [...]\n\n"
+		"Renders images and live devices in the register layout of the\n"
+		"ADM1166.txt export.  With -o every source gets its own report\n"
+		"file and up to <jobs> sources are processed in parallel.  -p\n"
+		"leaves out the decoded fields, -n takes the state names from an\n"
+		"ADM1166.txt export.\n", name);
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned int jobs = 8, running = 0, failed = 0;
+	int status;
+	pid_t pid;
+	int opt, i;
+
+	while ((opt = getopt(argc, argv, "j:n:o:p")) != -1) {
+		switch (opt) {
+		case 'j':
+			jobs = strtoul(optarg, NULL, 0);
+			break;
+		case 'n':
+			if (load_names(optarg) < 0)
+				exit(1);
+			break;
+		case 'o':
+			prefix = optarg;
+			break;
+		case 'p':
+			flags |= ADM1166_REPORT_PLAIN;
+			break;
+		default:
+			usage(argv[0]);
+			exit(1);
+		}
+	}
+
+	if (optind == argc || jobs == 0) {
+		usage(argv[0]);
+		return 0;
+	}
+
+	/* On stdout the reports have to come out in order */
+	if (prefix == NULL || optind + 1 == argc) {
+		for (i = optind; i < argc; i++) {
+			if (report_source(argv[i]) < 0) {
+				fprintf(stderr, "Report of %s failed\n", argv[i]);
+				failed++;
+			}
+		}
+		return failed ? 1 : 0;
+	}
+
+	fflush(stdout);
+
+	for (i = optind; i < argc || running; ) {
+		if (i < argc && running < jobs) {
+			pid = fork();
+			if (pid < 0) {
+				perror("Failed to fork");
+				failed++;
+			} else if (pid == 0) {
+				exit(report_source(argv[i]) < 0 ? 1 : 0);
+			} else {
+				running++;
+			}
+			i++;
+			continue;
+		}
+		if (wait(&status) < 0)
+			break;
+		running--;
+		if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+			failed++;
+	}
+
+	if (failed)
+		fprintf(stderr, "%u reports failed\n", failed);
+
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,464 @@
+/*
+ * Copyright (C) 2015-2016 Analog Devices, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * */
+
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "adm1166.h"
+
+#define MAX_AXES	ADM1166_NUM_DACS
+#define MAX_BOARDS	64
+
+struct shmoo_axis {
+	unsigned int dac;
+	int channel;
+	int from;
+	int to;
+	int step;
+	int offset;
+	unsigned char code;
+	unsigned char dnlim;
+	unsigned char dplim;
+	unsigned char saved_ctrl;
+	unsigned char saved_code;
+	int saved;
+};
+
+struct shmoo_board {
+	const char *target;
+	pid_t pid;
+};
+
+static struct shmoo_axis axes[MAX_AXES];
+static unsigned int num_axes;
+static const char *test_cmd;
+static const char *prefix = "shmoo";
+static unsigned int settle_tolerance = 4;
+static unsigned int settle_timeout_ms = 1000;
+
+static volatile sig_atomic_t stop;
+
+static void handle_signal(int sig)
+{
+	stop = 1;
+}
+
+static unsigned long long now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000;
+}
+
+static int parse_axis(char *arg, struct shmoo_axis *axis)
+{
+	char *tok[5];
+	unsigned int i;
+
+	for (i = 0; i < 5; i++) {
+		tok[i] = strsep(&arg, ":");
+		if (tok[i] == NULL)
+			return -1;
+	}
+	if (arg != NULL)
+		return -1;
+
+	axis->dac = strtoul(tok[0], NULL, 0);
+	if (axis->dac < 1 || axis->dac > ADM1166_NUM_DACS)
+		return -1;
+
+	if (strcmp(tok[1], "-") == 0) {
+		axis->channel = -1;
+	} else {
+		axis->channel = adm1166_adc_channel_by_name(tok[1]);
+		if (axis->channel < 0)
+			return -1;
+	}
+
+	axis->from = strtol(tok[2], NULL, 0);
+	axis->to = strtol(tok[3], NULL, 0);
+	axis->step = strtol(tok[4], NULL, 0);
+	if (axis->step <= 0 || axis->from > axis->to)
+		return -1;
+
+	return 0;
+}
+
+/*
+ * Wait until every readback channel touched by the current point stops
+ * moving by more than the settle tolerance between two reads.
+ */
+static int wait_settled(struct adm1166 *dev, unsigned long long *elapsed)
+{
+	unsigned int prev[MAX_AXES], code;
+	unsigned long long start = now_ms();
+	unsigned int i, stable;
+	int ret;
+
+	for (i = 0; i < num_axes; i++) {
+		if (axes[i].channel < 0)
+			continue;
+		ret = adm1166_adc_read(dev, axes[i].channel, &prev[i]);
+		if (ret < 0)
+			return ret;
+	}
+
+	do {
+		usleep(5000);
+		stable = 1;
+		for (i = 0; i < num_axes; i++) {
+			if (axes[i].channel < 0)
+				continue;
+			ret = adm1166_adc_read(dev, axes[i].channel, &code);
+			if (ret < 0)
+				return ret;
+			if (abs((int)code - (int)prev[i]) > (int)settle_tolerance)
+				stable = 0;
+			prev[i] = code;
+		}
+		*elapsed = now_ms() - start;
+		if (stable)
+			return 0;
+	} while (*elapsed < settle_timeout_ms);
+
+	return -ETIMEDOUT;
+}
+
+/* Returns 1 without touching the DACs when a code is outside the limits */
+static int apply_point(struct adm1166 *dev)
+{
+	unsigned int i;
+	int code, clamped = 0;
+	int ret;
+
+	for (i = 0; i < num_axes; i++) {
+		code = ADM1166_DAC_MIDCODE + axes[i].offset;
+		if (code > axes[i].dplim) {
+			code = axes[i].dplim;
+			clamped = 1;
+		}
+		if (code < axes[i].dnlim) {
+			code = axes[i].dnlim;
+			clamped = 1;
+		}
+		axes[i].code = code;
+	}
+	if (clamped)
+		return 1;
+
+	for (i = 0; i < num_axes; i++) {
+		ret = adm1166_reg_write(dev, ADM1166_REG_DAC(axes[i].dac),
+			axes[i].code);
+		if (ret < 0)
+			return ret;
+	}
+
+	return 0;
+}
+
+static int run_test(struct shmoo_board *board)
+{
+	char name[16], val[16];
+	unsigned int i;
+	int status;
+
+	setenv("ADM1166_TARGET", board->target, 1);
+	for (i = 0; i < num_axes; i++) {
+		snprintf(name, sizeof(name), "ADM1166_DAC%u", axes[i].dac);
+		snprintf(val, sizeof(val), "0x%02x", axes[i].code);
+		setenv(name, val, 1);
+	}
+
+	status = system(test_cmd);
+	if (status < 0)
+		return -errno;
+	/* system() ignores SIGINT while the command runs */
+	if (WIFSIGNALED(status) &&
+	    (WTERMSIG(status) == SIGINT || WTERMSIG(status) == SIGTERM))
+		stop = 1;
+
+	return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+static int prepare_axes(struct adm1166 *dev)
+{
+	unsigned int i;
+	int ret;
+
+	for (i = 0; i < num_axes; i++)
+		axes[i].saved = 0;
+
+	for (i = 0; i < num_axes; i++) {
+		ret = adm1166_reg_read(dev, ADM1166_REG_DNLIM(axes[i].dac),
+			&axes[i].dnlim);
+		if (ret == 0)
+			ret = adm1166_reg_read(dev, ADM1166_REG_DPLIM(axes[i].dac),
+				&axes[i].dplim);
+		if (ret == 0)
+			ret = adm1166_reg_read(dev, ADM1166_REG_DACCTRL(axes[i].dac),
+				&axes[i].saved_ctrl);
+		if (ret == 0)
+			ret = adm1166_reg_read(dev, ADM1166_REG_DAC(axes[i].dac),
+				&axes[i].saved_code);
+		if (ret < 0)
+			return ret;
+		axes[i].saved = 1;
+
+		/* Limits that do not bracket the midcode would pin the DAC */
+		if (axes[i].dplim <= axes[i].dnlim ||
+		    axes[i].dnlim > ADM1166_DAC_MIDCODE ||
+		    axes[i].dplim < ADM1166_DAC_MIDCODE) {
+			fprintf(stderr, "DAC%u: limits %02x-%02x leave no margining "
+				"range around %02x\n", axes[i].dac, axes[i].dnlim,
+				axes[i].dplim, ADM1166_DAC_MIDCODE);
+			return -EINVAL;
+		}
+	}
+
+	return 0;
+}
+
+static int enable_axes(struct adm1166 *dev)
+{
+	unsigned int i;
+	int ret;
+
+	for (i = 0; i < num_axes; i++) {
+		ret = adm1166_reg_write(dev, ADM1166_REG_DACCTRL(axes[i].dac),
+			axes[i].saved_ctrl | ADM1166_DACCTRL_ENABLE);
+		if (ret < 0)
+			return ret;
+	}
+
+	return 0;
+}
+
+static void restore_axes(struct adm1166 *dev)
+{
+	unsigned int i;
+
+	for (i = 0; i < num_axes; i++) {
+		if (!axes[i].saved)
+			continue;
+		adm1166_reg_write(dev, ADM1166_REG_DAC(axes[i].dac),
+			axes[i].saved_code);
+		adm1166_reg_write(dev, ADM1166_REG_DACCTRL(axes[i].dac),
+			axes[i].saved_ctrl);
+	}
+}
+
+static int shmoo_board(struct shmoo_board *board)
+{
+	unsigned int points = 0, passed = 0;
+	unsigned long long settle_ms;
+	struct adm1166 dev;
+	char path[256];
+	FILE *grid;
+	unsigned int i;
+	int enabled = 0;
+	int ret;
+
+	snprintf(path, sizeof(path), "%s-%s.grid", prefix, board->target);
+	for (i = strlen(prefix) + 1; path[i]; i++) {
+		if (path[i] == ':' || path[i] == '/')
+			path[i] = '-';
+	}
+	grid = fopen(path, "w");
+	if (grid == NULL) {
+		perror("Failed to create grid file");
+		return -1;
+	}
+
+	ret = adm1166_open_target(&dev, board->target);
+	if (ret < 0) {
+		fclose(grid);
+		return -1;
+	}
+
+	ret = prepare_axes(&dev);
+	if (ret < 0)
+		goto out;
+
+	fprintf(grid, "#");
+	for (i = 0; i < num_axes; i++)
+		fprintf(grid, " dac%u_offset", axes[i].dac);
+	for (i = 0; i < num_axes; i++)
+		fprintf(grid, " dac%u_code", axes[i].dac);
+	fprintf(grid, " result settle_ms\n");
+
+	for (i = 0; i < num_axes; i++)
+		axes[i].offset = axes[i].from;
+
+	while (!stop) {
+		ret = apply_point(&dev);
+		if (ret == 0 && !enabled) {
+			ret = enable_axes(&dev);
+			enabled = 1;
+		}
+		if (ret < 0)
+			break;
+
+		settle_ms = 0;
+		if (ret == 0)
+			ret = wait_settled(&dev, &settle_ms);
+		if (ret < 0 && ret != -ETIMEDOUT)
+			break;
+
+		for (i = 0; i < num_axes; i++)
+			fprintf(grid, "%+d ", axes[i].offset);
+		for (i = 0; i < num_axes; i++)
+			fprintf(grid, "%02x ", axes[i].code);
+
+		if (ret == 1) {
+			fprintf(grid, "CLAMPED 0\n");
+		} else if (ret == -ETIMEDOUT) {
+			fprintf(grid, "UNSETTLED %llu\n", settle_ms);
+		} else {
+			ret = run_test(board);
+			if (ret < 0)
+				break;
+			fprintf(grid, "%s %llu\n", ret ? "PASS" : "FAIL", settle_ms);
+			passed += ret;
+		}
+		fflush(grid);
+		points++;
+		ret = 0;
+
+		for (i = 0; i < num_axes; i++) {
+			axes[i].offset += axes[i].step;
+			if (axes[i].offset <= axes[i].to)
+				break;
+			axes[i].offset = axes[i].from;
+		}
+		if (i == num_axes)
+			break;
+	}
+
+	printf("Board %s: %u/%u points passed, results in %s%s\n",
+		board->target, passed, points, path, stop ? " (interrupted)" : "");
+
+out:
+	/* Nothing to undo while the DACs were never enabled */
+	if (enabled)
+		restore_axes(&dev);
+	adm1166_close(&dev);
+	fclose(grid);
+
+	return ret;
+}
+
+static void usage(const char *name)
+{
+	printf("Usage: %s [-o <prefix>] [-s <tolerance>] [-t <timeout-ms>]\n"
+		"\t-c <test-command> -m <dac>:<channel>:<from>:<to>:<step> [-m ...]\n"
+		"\t<target> [<target> ...]\n\n"
+		"Sweeps the margining DACs through the grid of offsets from the DAC\n"
+		"midcode, waits for the readback channel to settle and runs the test\n"
+		"command at every point.  Boards are swept concurrently, results are\n"
+		"written to <prefix>-<target>.grid.  Points outside DNLIM-DPLIM are\n"
+		"marked CLAMPED and not tested.  Targets are <bus>[:<addr>] or\n"
+		"sim[:<ihex-file>].\n", name);
+}
+
+int main(int argc, char *argv[])
+{
+	struct shmoo_board boards[MAX_BOARDS];
+	unsigned int num_boards = 0;
+	unsigned int i, failed = 0;
+	pid_t pid;
+	int status;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "c:m:o:s:t:")) != -1) {
+		switch (opt) {
+		case 'c':
+			test_cmd = optarg;
+			break;
+		case 'm':
+			if (num_axes == MAX_AXES ||
+			    parse_axis(optarg, &axes[num_axes]) < 0) {
+				fprintf(stderr, "Invalid margin axis \"%s\"\n", optarg);
+				exit(1);
+			}
+			num_axes++;
+			break;
+		case 'o':
+			prefix = optarg;
+			break;
+		case 's':
+			settle_tolerance = strtoul(optarg, NULL, 0);
+			break;
+		case 't':
+			settle_timeout_ms = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+			exit(1);
+		}
+	}
+
+	if (test_cmd == NULL || num_axes == 0 || optind == argc) {
+		usage(argv[0]);
+		return 0;
+	}
+
+	for (i = optind; i < (unsigned int)argc; i++) {
+		if (num_boards == MAX_BOARDS) {
+			fprintf(stderr, "Too many boards\n");
+			exit(1);
+		}
+		boards[num_boards++].target = argv[i];
+	}
+
+	fflush(stdout);
+
+	/* Each board stops at the next point and restores its DACs */
+	signal(SIGINT, handle_signal);
+	signal(SIGTERM, handle_signal);
+
+	for (i = 0; i < num_boards; i++) {
+		boards[i].pid = fork();
+		if (boards[i].pid < 0) {
+			perror("Failed to fork");
+			failed++;
+		} else if (boards[i].pid == 0) {
+			exit(shmoo_board(&boards[i]) < 0 ? 1 : 0);
+		}
+	}
+
+	for (i = 0; i < num_boards; i++) {
+		if (boards[i].pid <= 0)
+			continue;
+		do {
+			pid = waitpid(boards[i].pid, &status, 0);
+		} while (pid < 0 && errno == EINTR);
+		if (pid < 0 ||
+		    !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+			fprintf(stderr, "Shmoo of board %s failed\n",
+				boards[i].target);
+			failed++;
+		}
+	}
+
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,710 @@
+/*
+ * Copyright (C) 2015-2016 Analog Devices, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * */
+
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "adm1166.h"
+#include "probes.h"
+#include "proto.h"
+
+#define RECONNECT_MS	1000
+/* Starting guess for a background job, a page read at 400 kHz */
+#define JOB_COST_US	1000
+
+struct push {
+	const char *endpoint;
+	const char *id;
+	int fd;
+	struct proto_queue q;
+	unsigned long long reported;
+	unsigned long long retry_us;
+	struct adm1166_sample *batch;
+	unsigned int num;
+	unsigned int size;
+	unsigned int last_state;
+	struct adm1166_se_state se[ADM1166_SE_STATES];
+};
+
+/* Background job run in the slack between samples */
+struct job {
+	unsigned int gap_ms;
+	unsigned long long next_us;
+	unsigned long long cost_us;
+};
+
+struct scrub {
+	struct job job;
+	struct adm1166_scrub s;
+	const struct adm1166_image *ref;
+	int repair;
+	unsigned long long alarms;
+	/* Repair worker, the scrub pauses while it runs */
+	struct adm1166 *dev;
+	pthread_t tid;
+	pthread_mutex_t lock;
+	int busy;
+	int done;
+	int ret;
+	unsigned int pages;
+};
+
+struct drift {
+	struct job job;
+	int loaded;
+	unsigned char ee[5 * ADM1166_PAGE_SIZE];
+	unsigned char ignore[ADM1166_NUM_REGS];
+	struct adm1166_drift last[ADM1166_NUM_REGS];
+	unsigned int num;
+	unsigned long long changes;
+};
+
+static volatile sig_atomic_t stop;
+
+static void handle_signal(int sig)
+{
+	stop = 1;
+}
+
+static void push_frame(struct push *p, unsigned int type,
+	const struct proto_buf *b)
+{
+	if (proto_queue_push(&p->q, type, b->data, b->len) < 0)
+		p->q.dropped++;
+}
+
+static void push_batch(struct push *p)
+{
+	struct proto_buf b = { NULL, 0, 0 };
+
+	if (p->num == 0)
+		return;
+	if (adm1166_samples_encode(&b, p->batch, p->num) == 0)
+		push_frame(p, ADM1166_MSG_SAMPLES, &b);
+	proto_buf_free(&b);
+	p->num = 0;
+}
+
+/*
+ * Transitions into the monitor next state of the old state are faults.
+ * The old state outlives the batch, which is flushed at every fault.
+ */
+static void push_sample(struct push *p, const struct adm1166_sample *s)
+{
+	struct proto_buf b = { NULL, 0, 0 };
+	struct adm1166_event ev;
+	unsigned int prev = p->last_state;
+
+	if (s->state != prev && prev < ADM1166_SE_STATES &&
+	    p->se[prev].monitor_mask && s->state == p->se[prev].next_monitor) {
+		ev.t_us = s->t_us;
+		ev.from = prev;
+		ev.to = s->state;
+		ev.pdo = s->pdo;
+		/* Keep the samples before the fault ahead of the event */
+		push_batch(p);
+		if (adm1166_event_encode(&b, &ev) == 0)
+			push_frame(p, ADM1166_MSG_EVENT, &b);
+		proto_buf_free(&b);
+	}
+	p->last_state = s->state;
+
+	if (p->num == p->size)
+		push_batch(p);
+	p->batch[p->num++] = *s;
+}
+
+static void push_disconnect(struct push *p, unsigned long long now_us)
+{
+	close(p->fd);
+	p->fd = -1;
+	proto_queue_rewind(&p->q);
+	p->retry_us = now_us + RECONNECT_MS * 1000ULL;
+}
+
+/*
+ * Never blocks for long: the connect is bounded by a quarter of the
+ * sampling interval and frames go out as far as the socket takes them,
+ * the rest waits in the bounded queue.
+ */
+static void push_service(struct push *p, unsigned long long now_us,
+	unsigned int interval_ms)
+{
+	struct proto_buf b = { NULL, 0, 0 }, hello = { NULL, 0, 0 };
+	int ret;
+
+	if (p->fd < 0) {
+		if (now_us < p->retry_us)
+			return;
+		p->fd = proto_connect(p->endpoint, interval_ms / 4 + 1);
+		if (p->fd < 0) {
+			p->retry_us = now_us + RECONNECT_MS * 1000ULL;
+			return;
+		}
+		ret = proto_put_varint(&b, ADM1166_PROTO_VERSION);
+		if (ret == 0)
+			ret = proto_put_bytes(&b, p->id, strlen(p->id));
+		if (ret == 0)
+			ret = proto_frame(&hello, ADM1166_MSG_HELLO, b.data,
+				b.len);
+		if (ret == 0)
+			ret = proto_send_all(p->fd, hello.data, hello.len);
+		proto_buf_free(&hello);
+		proto_buf_free(&b);
+		if (ret < 0) {
+			push_disconnect(p, now_us);
+			return;
+		}
+	}
+
+	if (p->q.dropped > p->reported) {
+		if (proto_put_varint(&b, p->q.dropped - p->reported) == 0) {
+			p->reported = p->q.dropped;
+			push_frame(p, ADM1166_MSG_DROPPED, &b);
+		}
+		proto_buf_free(&b);
+	}
+
+	if (proto_queue_flush(&p->q, p->fd) < 0)
+		push_disconnect(p, now_us);
+}
+
+static int push_load_se(struct push *p, struct adm1166 *dev)
+{
+	struct adm1166_image img;
+	unsigned int i;
+	int ret;
+
+	ret = adm1166_image_read(dev, &img);
+	if (ret < 0)
+		return ret;
+	for (i = 0; i < ADM1166_SE_STATES; i++)
+		adm1166_se_decode(img.data + ADM1166_SE_BASE - ADM1166_EEPROM_BASE +
+			8 * i, &p->se[i]);
+
+	return 0;
+}
+
+static int push_init(struct push *p, struct adm1166 *dev)
+{
+	p->fd = -1;
+	p->batch = calloc(p->size, sizeof(*p->batch));
+	if (p->batch == NULL)
+		return -ENOMEM;
+
+	return push_load_se(p, dev);
+}
+
+static unsigned long long now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+/*
+ * At most once per gap, and only when twice the cost measured so far fits
+ * into the time left before the next sample is due.
+ */
+static int job_due(struct job *job, unsigned long long now,
+	unsigned long long deadline_us)
+{
+	return job->gap_ms && now >= job->next_us &&
+		now + 2 * job->cost_us <= deadline_us;
+}
+
+static void job_done(struct job *job, unsigned long long t0,
+	unsigned long long t1)
+{
+	job->cost_us = (3 * job->cost_us + t1 - t0) / 4;
+	job->next_us = t1 + job->gap_ms * 1000ULL;
+}
+
+/*
+ * Rewrites the pages that differ from the reference without activating
+ * them, like adm1166_eeprom -r: the sequence engine is left halted and
+ * the repaired configuration loads at the next reboot.
+ */
+static void *scrub_repair(void *arg)
+{
+	struct scrub *sc = arg;
+	struct adm1166_plan *plan;
+	unsigned int pages = 0;
+	int ret = -ENOMEM;
+
+	plan = malloc(sizeof(*plan));
+	if (plan) {
+		ret = adm1166_plan(sc->dev, sc->ref, plan, NULL);
+		if (ret == 0) {
+			pages = plan->num_pages;
+			ret = adm1166_plan_execute(sc->dev, plan, NULL);
+		}
+		free(plan);
+	}
+
+	pthread_mutex_lock(&sc->lock);
+	sc->ret = ret;
+	sc->pages = pages;
+	sc->done = 1;
+	pthread_mutex_unlock(&sc->lock);
+
+	return NULL;
+}
+
+/* Returns 1 once a repair finished, the EEPROM copies are stale then */
+static int scrub_repair_done(struct scrub *sc, struct push *p, FILE *log)
+{
+	unsigned long long passes;
+	int done;
+
+	pthread_mutex_lock(&sc->lock);
+	done = sc->done;
+	pthread_mutex_unlock(&sc->lock);
+	if (!done)
+		return 0;
+
+	pthread_join(sc->tid, NULL);
+	sc->busy = 0;
+	sc->done = 0;
+	fprintf(stderr, "EEPROM scrub: repair of %u pages %s\n", sc->pages,
+		sc->ret < 0 ? "failed" : "done, active after reboot");
+	if (sc->pages)
+		fprintf(stderr, "EEPROM scrub: sequence engine halted until "
+			"the next reboot\n");
+	if (log)
+		fprintf(log, "# scrub: repair of %u pages %s%s\n", sc->pages,
+			sc->ret < 0 ? "failed" : "done",
+			sc->pages ? ", sequence engine halted" : "");
+	if (p->endpoint)
+		push_load_se(p, sc->dev);
+	passes = sc->s.passes;
+	adm1166_scrub_init(&sc->s, sc->ref);
+	sc->s.passes = passes;
+
+	return 1;
+}
+
+/*
+ * Mismatches are only reported unless repairs were asked for, those run
+ * in a worker so the sampling goes on meanwhile.  Returns 1 after a
+ * repair.
+ */
+static int scrub_service(struct adm1166 *dev, struct scrub *sc,
+	struct push *p, FILE *log, unsigned long long deadline_us)
+{
+	struct proto_buf b = { NULL, 0, 0 };
+	unsigned long long t0 = now_us(), t1;
+	unsigned int addr = 0;
+	int ret, err;
+
+	if (sc->busy)
+		return scrub_repair_done(sc, p, log);
+
+	if (!job_due(&sc->job, t0, deadline_us))
+		return 0;
+
+	ret = adm1166_scrub_step(dev, &sc->s, &addr);
+	t1 = now_us();
+	job_done(&sc->job, t0, t1);
+	if (ret <= 0)
+		return 0;
+
+	sc->alarms++;
+	fprintf(stderr, "EEPROM scrub: %d %s at %x\n", ret,
+		sc->s.use_ref ? "bytes differ" : "checksums fail", addr);
+	if (log)
+		fprintf(log, "# scrub: %d %s at %x\n", ret,
+			sc->s.use_ref ? "bytes differ" : "checksums fail", addr);
+	if (p->endpoint) {
+		err = proto_put_varint(&b, t1);
+		if (err == 0)
+			err = proto_put_varint(&b, addr);
+		if (err == 0)
+			err = proto_put_varint(&b, ret);
+		if (err == 0)
+			push_frame(p, ADM1166_MSG_SCRUB, &b);
+		proto_buf_free(&b);
+	}
+
+	if (!sc->repair)
+		return 0;
+	sc->dev = dev;
+	if (pthread_create(&sc->tid, NULL, scrub_repair, sc) != 0) {
+		fprintf(stderr, "Failed to start the repair\n");
+		return 0;
+	}
+	sc->busy = 1;
+
+	return 0;
+}
+
+/*
+ * The EEPROM copy is read once and again after a repair, every check
+ * after that is one register block read.  Only changes are reported.
+ */
+static void drift_service(struct adm1166 *dev, struct drift *dr,
+	struct push *p, FILE *log, unsigned long long deadline_us)
+{
+	struct adm1166_drift d[ADM1166_NUM_REGS];
+	struct proto_buf b = { NULL, 0, 0 };
+	unsigned char live[ADM1166_NUM_REGS];
+	unsigned long long t0 = now_us(), t1;
+	unsigned int i, n;
+	int ret = 0;
+
+	if (!job_due(&dr->job, t0, deadline_us))
+		return;
+
+	if (!dr->loaded) {
+		for (i = 0; i < sizeof(dr->ee) && ret == 0; i += ADM1166_PAGE_SIZE)
+			ret = adm1166_eeprom_read(dev, ADM1166_EEPROM_BASE + i,
+				dr->ee + i);
+		dr->loaded = ret == 0;
+		job_done(&dr->job, t0, now_us());
+		return;
+	}
+
+	ret = adm1166_regs_read(dev, 0, live, sizeof(live));
+	t1 = now_us();
+	job_done(&dr->job, t0, t1);
+	if (ret < 0)
+		return;
+
+	n = adm1166_drift(live, dr->ee, dr->ignore, d);
+	if (n == dr->num && memcmp(d, dr->last, n * sizeof(*d)) == 0)
+		return;
+	memcpy(dr->last, d, n * sizeof(*d));
+	dr->num = n;
+	dr->changes++;
+
+	fprintf(stderr, "Register drift: %u registers differ from the EEPROM\n",
+		n);
+	if (log) {
+		for (i = 0; i < n; i++)
+			adm1166_drift_print(log, "# drift: ", &d[i]);
+		if (n == 0)
+			fprintf(log, "# drift: none\n");
+	}
+	if (p->endpoint) {
+		ret = proto_put_varint(&b, t1);
+		if (ret == 0)
+			ret = proto_put_varint(&b, n);
+		for (i = 0; i < n && ret == 0; i++) {
+			ret = proto_put_varint(&b, d[i].reg);
+			if (ret == 0)
+				ret = proto_put_varint(&b, d[i].ee);
+			if (ret == 0)
+				ret = proto_put_varint(&b, d[i].live);
+		}
+		if (ret == 0)
+			push_frame(p, ADM1166_MSG_DRIFT, &b);
+		proto_buf_free(&b);
+	}
+}
+
+static int parse_channels(const char *list, unsigned int *mask)
+{
+	char name[16];
+	int ch, n;
+
+	*mask = 0;
+	while (*list) {
+		if (sscanf(list, "%15[^,]%n", name, &n) != 1)
+			return -EINVAL;
+		ch = adm1166_adc_channel_by_name(name);
+		if (ch < 0)
+			return -EINVAL;
+		*mask |= 1 << ch;
+		list += n;
+		if (*list == ',')
+			list++;
+	}
+
+	return *mask ? 0 : -EINVAL;
+}
+
+/*
+ * Sets the round robin up for the sampled channels and the noise target,
+ * and stretches the interval to the cycle so no read sees the same
+ * conversion twice.
+ */
+static int readback_init(struct adm1166 *dev, unsigned int mask, float noise,
+	unsigned int *interval_ms, struct adm1166_readback *rb)
+{
+	int ret;
+
+	ret = adm1166_readback_tune(dev, mask, noise, *interval_ms * 1000, rb);
+	if (ret < 0)
+		return ret;
+	if (ret)
+		fprintf(stderr, "Readback noise %.2f codes over the target of %.2f%s\n",
+			rb->avg ? rb->noise / 4 : rb->noise, noise,
+			rb->avg ? "" : ", averaging does not fit the interval");
+	fprintf(stderr, "Readback: %u channels, %s, one cycle per %.2f ms\n",
+		__builtin_popcount(rb->mask),
+		rb->avg ? "averaged" : "not averaged", rb->cycle_us / 1000.0);
+
+	if (rb->cycle_us > *interval_ms * 1000) {
+		*interval_ms = (rb->cycle_us + 999) / 1000;
+		fprintf(stderr, "Sampling every %u ms\n", *interval_ms);
+	}
+
+	return 0;
+}
+
+static void usage(const char *name)
+{
+	printf("Usage: %s [-i <interval-ms>] [-n <samples>] [-o <log-file>]\n"
+		"       [-c <host:port> [-I <id>] [-b <batch>] [-B <buffer-kib>]]\n"
+		"       [-S <page-gap-ms> [-s <image> [-R]]] [-D <drift-ms>]\n"
+		"       [-C <channel>[,...]] [-N <noise>] <target>\n\n"
+		"Samples the ADM1166 sequencer state, PDO status and ADC readback\n"
+		"channels, including the on-chip temperature sensor, at a fixed\n"
+		"interval and appends them to the log.  With -c the samples are\n"
+		"pushed to a collector in batches, together with fault events;\n"
+		"while it is unreachable up to <buffer-kib> are kept, oldest\n"
+		"batches dropped first.\n\n"
+		"With -S the EEPROM is scrubbed in the background, one page at\n"
+		"most every <page-gap-ms> and only in the slack between samples.\n"
+		"Pages are compared against <image> when given, otherwise against\n"
+		"the stored checksums, mismatches are reported.  -R rewrites the\n"
+		"pages that differ in the background, without activating them:\n"
+		"the sequence engine stays halted until the next reboot.\n\n"
+		"With -D the live configuration registers are compared with the\n"
+		"EEPROM every <drift-ms>, also in the slack, and changes in the\n"
+		"set of registers that differ are reported.\n\n"
+		"With -C or -N the readback engine is set up at start: only the\n"
+		"given channels are converted and read, and averaging is turned\n"
+		"on when the measured noise is above <noise> codes RMS and the\n"
+		"averaged round robin fits into the interval.  The interval is\n"
+		"stretched to the round robin cycle when that is longer.\n", name);
+}
+
+int main(int argc, char *argv[])
+{
+	struct push push = { .size = 50, .q = { .max = 256 * 1024 },
+			     .last_state = ADM1166_SE_STATES };
+	struct scrub scrub = { .job = { .cost_us = JOB_COST_US } };
+	struct drift drift = { .job = { .cost_us = JOB_COST_US } };
+	struct adm1166_readback rb = { .mask = (1 << ADM1166_ADC_CHANNELS) - 1 };
+	unsigned char rr[3];
+	float noise = 0;
+	int readback = 0;
+	struct adm1166_image *ref = NULL;
+	struct adm1166_sample sample;
+	unsigned long long count = 0, samples = 0, deadline_us;
+	unsigned int interval_ms = 100;
+	struct timespec next;
+	static pthread_mutex_t dev_lock = PTHREAD_MUTEX_INITIALIZER;
+	struct adm1166 dev;
+	unsigned char tsctrl;
+	FILE *log = NULL;
+	int ret = 0;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "b:B:c:C:D:i:I:n:N:o:Rs:S:")) != -1) {
+		switch (opt) {
+		case 'b':
+			push.size = strtoul(optarg, NULL, 0);
+			break;
+		case 'B':
+			push.q.max = strtoul(optarg, NULL, 0) * 1024;
+			break;
+		case 'c':
+			push.endpoint = optarg;
+			break;
+		case 'C':
+			if (parse_channels(optarg, &rb.mask) < 0) {
+				fprintf(stderr, "Invalid channel list %s\n", optarg);
+				exit(1);
+			}
+			readback = 1;
+			break;
+		case 'D':
+			drift.job.gap_ms = strtoul(optarg, NULL, 0);
+			break;
+		case 'i':
+			interval_ms = strtoul(optarg, NULL, 0);
+			break;
+		case 'I':
+			push.id = optarg;
+			break;
+		case 'n':
+			samples = strtoull(optarg, NULL, 0);
+			break;
+		case 'N':
+			noise = strtof(optarg, NULL);
+			readback = 1;
+			break;
+		case 'o':
+			log = fopen(optarg, "a");
+			if (log == NULL) {
+				perror("Failed to open log file");
+				exit(1);
+			}
+			break;
+		case 'R':
+			scrub.repair = 1;
+			break;
+		case 's':
+			ref = malloc(sizeof(*ref));
+			if (ref == NULL || adm1166_image_load(ref, optarg) < 0)
+				exit(1);
+			break;
+		case 'S':
+			scrub.job.gap_ms = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+			exit(1);
+		}
+	}
+
+	if (optind + 1 != argc || interval_ms == 0 || push.size == 0 ||
+	    (scrub.repair && ref == NULL)) {
+		usage(argv[0]);
+		return 0;
+	}
+	if (log == NULL && push.endpoint == NULL)
+		log = stdout;
+	if (push.id == NULL)
+		push.id = argv[optind];
+
+	if (adm1166_open_target(&dev, argv[optind]) < 0)
+		exit(1);
+	/* The repair worker programs while the sampling goes on */
+	if (scrub.repair)
+		dev.lock = &dev_lock;
+
+	if (push.endpoint && push_init(&push, &dev) < 0) {
+		adm1166_close(&dev);
+		exit(1);
+	}
+
+	/* The temperature channel only converts with the sensor enabled */
+	if (adm1166_reg_read(&dev, ADM1166_REG_TSCTRL, &tsctrl) < 0 ||
+	    adm1166_reg_write(&dev, ADM1166_REG_TSCTRL,
+		tsctrl | ADM1166_TSCTRL_ENABLE) < 0) {
+		adm1166_close(&dev);
+		exit(1);
+	}
+
+	if (readback) {
+		if (adm1166_regs_read(&dev, ADM1166_REG_RRSEL1, rr, 3) < 0 ||
+		    readback_init(&dev, rb.mask, noise, &interval_ms, &rb) < 0) {
+			adm1166_close(&dev);
+			exit(1);
+		}
+		/* Not drift either */
+		memset(drift.ignore + ADM1166_REG_RRSEL1, 0xff, 3);
+	}
+
+	scrub.ref = ref;
+	pthread_mutex_init(&scrub.lock, NULL);
+	if (scrub.job.gap_ms)
+		adm1166_scrub_init(&scrub.s, ref);
+	/* Not drift, the temperature sensor is enabled for the sampling */
+	drift.ignore[ADM1166_REG_TSCTRL] = ~tsctrl & ADM1166_TSCTRL_ENABLE;
+
+	signal(SIGINT, handle_signal);
+	signal(SIGTERM, handle_signal);
+
+	if (log)
+		adm1166_sample_print_header(log);
+
+	clock_gettime(CLOCK_MONOTONIC, &next);
+	while (!stop && (samples == 0 || count < samples)) {
+		ret = adm1166_sample_read_channels(&dev, rb.mask, &sample);
+		PROBE4(sampler__tick, dev.bus, dev.addr, count, ret);
+		if (ret < 0)
+			break;
+		if (log) {
+			adm1166_sample_print(log, &sample);
+			fflush(log);
+		}
+		if (push.endpoint) {
+			push_sample(&push, &sample);
+			push_service(&push, now_us(), interval_ms);
+		}
+		count++;
+
+		/* Absolute deadlines, a slow transaction does not shift the grid */
+		next.tv_nsec += interval_ms * 1000000L;
+		while (next.tv_nsec >= 1000000000L) {
+			next.tv_nsec -= 1000000000L;
+			next.tv_sec++;
+		}
+		deadline_us = next.tv_sec * 1000000ULL + next.tv_nsec / 1000;
+		if (scrub_service(&dev, &scrub, &push, log, deadline_us)) {
+			/* The repair halted the engine, that is not drift */
+			drift.ignore[ADM1166_REG_SECTRL] |= ADM1166_SECTRL_HALT;
+			drift.loaded = 0;
+		}
+		/* Registers and EEPROM are in flux while a repair runs */
+		if (!scrub.busy)
+			drift_service(&dev, &drift, &push, log, deadline_us);
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+	}
+
+	if (scrub.busy) {
+		fprintf(stderr, "Waiting for the EEPROM repair\n");
+		pthread_join(scrub.tid, NULL);
+	}
+	pthread_mutex_destroy(&scrub.lock);
+	if (scrub.job.gap_ms)
+		fprintf(stderr, "EEPROM scrub: %llu passes, %llu alarms\n",
+			scrub.s.passes, scrub.alarms);
+	free(ref);
+
+	adm1166_reg_write(&dev, ADM1166_REG_TSCTRL, tsctrl);
+	if (readback) {
+		adm1166_reg_write(&dev, ADM1166_REG_RRCTRL, 0);
+		adm1166_reg_write(&dev, ADM1166_REG_RRSEL1, rr[0]);
+		adm1166_reg_write(&dev, ADM1166_REG_RRSEL2, rr[1]);
+		adm1166_reg_write(&dev, ADM1166_REG_RRCTRL, rr[2]);
+	}
+	adm1166_close(&dev);
+	if (log && log != stdout)
+		fclose(log);
+
+	if (push.endpoint) {
+		/* Give the collector up to a second for the rest */
+		push_batch(&push);
+		push.retry_us = 0;
+		for (count = 0; count < 100 && push.q.head < push.q.buf.len;
+		     count++) {
+			push_service(&push, now_us(), interval_ms);
+			usleep(10000);
+		}
+		if (push.q.head < push.q.buf.len)
+			fprintf(stderr, "%zu bytes not delivered\n",
+				push.q.buf.len - push.q.head);
+		if (push.q.dropped)
+			fprintf(stderr, "%llu frames dropped\n", push.q.dropped);
+		if (push.fd >= 0)
+			close(push.fd);
+		proto_buf_free(&push.q.buf);
+		free(push.batch);
+	}
+
+	return ret < 0 ? 1 : 0;
+}
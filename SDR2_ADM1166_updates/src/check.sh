@@ -0,0 +1,90 @@
+#!/bin/sh
+#
+# Copyright (C) 2015-2016 Analog Devices, Inc.
+#
+# This library is free software; you can redistribute it and/or
+# modify it under the terms of the GNU Lesser General Public
+# License as published by the Free Software Foundation; either
+# version 2.1 of the License, or (at your option) any later version.
+#
+# This library is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+# Lesser General Public License for more details.
+#
+# Runs the tools against the simulated device loaded with the shipped
+# image, no hardware needed.  Called by "make check".
+
+IMAGE=../ADM1166.hex
+TMP=$(mktemp -d)
+PORT=$((20000 + $$ % 10000))
+failed=0
+
+trap 'rm -rf "$TMP"' EXIT
+
+fail()
+{
+	echo "FAIL: $*"
+	failed=1
+}
+
+# A fault on every rail moves the sequencer and the PDOs within the timeout
+./adm1166_latency -n 3 -r VP1:1:0xff -r VH:2:0x00 "sim:$IMAGE" \
+	> "$TMP/latency" 2>&1 || fail "adm1166_latency exited with $?"
+for rail in VP1 VH; do
+	grep -q "^$rail .* 3 .*(poll" "$TMP/latency" ||
+		fail "adm1166_latency: no row for $rail"
+done
+grep -q "no PDO change\|no state change" "$TMP/latency" &&
+	fail "adm1166_latency: fault not seen"
+
+# Telemetry pushes every sample over loopback, the collector logs them
+./adm1166_collector -o "$TMP/col" "127.0.0.1:$PORT" > "$TMP/collector" 2>&1 &
+collector=$!
+sleep 0.3
+./adm1166_telemetry -i 10 -n 50 -c "127.0.0.1:$PORT" -I b1 \
+	"sim:$IMAGE" > "$TMP/telemetry" 2>&1 ||
+	fail "adm1166_telemetry exited with $?"
+sleep 0.3
+kill $collector
+wait $collector
+samples=$(grep -vc "^#" "$TMP/col-b1.log" 2>/dev/null)
+[ "$samples" = 50 ] ||
+	fail "adm1166_collector: ${samples:-no} samples logged, expected 50"
+grep -q "50 samples" "$TMP/collector" ||
+	fail "adm1166_collector: summary does not count 50 samples"
+
+# The orchestrator drives an agent: snapshot, program a changed user
+# EEPROM byte, verify both images and read telemetry back
+AGENT="127.0.0.1:$((PORT + 1))"
+sed 's/^:10F900007FFC/:10F900007EFC/' "$IMAGE" > "$TMP/changed.hex"
+./adm1166_agent -t "sim:$IMAGE" "$AGENT" > "$TMP/agent" 2>&1 &
+agent=$!
+sleep 0.3
+orch()
+{
+	./adm1166_orch "$@" "$AGENT" >> "$TMP/orch" 2>&1
+}
+orch -a snapshot -o "$TMP/snap" || fail "adm1166_orch: snapshot failed"
+[ "$(wc -c < "$TMP/snap-127.0.0.1-$((PORT + 1)).bin" 2>/dev/null)" = 1024 ] ||
+	fail "adm1166_orch: snapshot is not a 1024 byte EEPROM image"
+orch -a program -i "$TMP/changed.hex" || fail "adm1166_orch: program failed"
+grep -q "programmed 1 pages" "$TMP/orch" ||
+	fail "adm1166_orch: program did not rewrite exactly the changed page"
+orch -a verify -i "$TMP/changed.hex" ||
+	fail "adm1166_orch: verify of the new image failed"
+orch -a verify -i "$IMAGE" &&
+	fail "adm1166_orch: verify of the old image passed"
+grep -q "1 bytes differ, first at f900" "$TMP/orch" ||
+	fail "adm1166_orch: verify did not find the changed byte"
+orch -a telemetry -n 3 -I 10 || fail "adm1166_orch: telemetry failed"
+[ "$(grep -c "^$AGENT [0-9]" "$TMP/orch")" = 3 ] ||
+	fail "adm1166_orch: telemetry did not return 3 samples"
+kill $agent
+wait $agent
+
+if [ $failed -ne 0 ]; then
+	cat "$TMP"/*
+	exit 1
+fi
+echo "All checks passed"
@@ -0,0 +1,508 @@
+/*
+ * Copyright (C) 2015-2016 Analog Devices, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "ihex.h"
+
+enum item_type {
+	ITEM_RECORD,
+	ITEM_END_OF_FILE,
+	ITEM_TEXT,
+};
+
+/*
+ * What a range of the input parses to, in order.  Text outside of records
+ * is only an error inside an image, that is decided when the ranges are
+ * merged.  Line numbers are relative to the start of the range.
+ */
+struct item {
+	enum item_type type;
+	unsigned int line;
+	unsigned int col;
+	int c;
+	struct ihex_chunk *chunk;
+};
+
+struct range {
+	const char *p;
+	const char *end;
+	int stop_at_eof;
+	int check_csum;
+	struct item *items;
+	unsigned int num;
+	unsigned int size;
+	unsigned int lines;
+	/* First hard error, line 0 if none */
+	unsigned int err_line;
+	unsigned int err_col;
+	int err_c;
+	int err_csum;
+	int err_nomem;
+};
+
+struct cursor {
+	const char *p;
+	const char *end;
+	const char *bol;
+	unsigned int line;
+};
+
+static void err_unexpected_char(int c, unsigned int line, unsigned int col)
+{
+	if (c < 0)
+		fprintf(stderr, "Unexpected end of file at line %u(%u)\n", line,
+			col);
+	else
+		fprintf(stderr, "Unexpected character: %x at line %u(%u)\n", c,
+			line, col);
+}
+
+static int get_hex_token(struct cursor *cur, unsigned int len,
+	unsigned int *val)
+{
+	unsigned int i;
+	int c;
+
+	*val = 0;
+
+	for (i = 0; i < len; i++) {
+		if (cur->p == cur->end)
+			return -1;
+		c = (unsigned char)*cur->p;
+		*val <<= 4;
+		if ((c >= '0' && c <= '9')) {
+			*val |= c - '0';
+		} else if (c >= 'A' && c <= 'F') {
+			*val |= c - 'A' + 10;
+		} else {
+			return -1;
+		}
+		cur->p++;
+	}
+
+	return 0;
+}
+
+static struct item *range_add(struct range *r, enum item_type type,
+	const struct cursor *cur)
+{
+	struct item *tmp;
+
+	if (r->num == r->size) {
+		r->size = r->size ? r->size * 2 : 256;
+		tmp = realloc(r->items, r->size * sizeof(*r->items));
+		if (tmp == NULL) {
+			r->err_nomem = 1;
+			return NULL;
+		}
+		r->items = tmp;
+	}
+
+	tmp = &r->items[r->num++];
+	memset(tmp, 0x00, sizeof(*tmp));
+	tmp->type = type;
+	tmp->line = cur->line;
+	tmp->col = cur->p - cur->bol + 1;
+
+	return tmp;
+}
+
+static void range_error(struct range *r, const struct cursor *cur)
+{
+	r->err_line = cur->line;
+	r->err_col = cur->p - cur->bol + 1;
+	r->err_c = cur->p < cur->end ? (unsigned char)*cur->p : -1;
+}
+
+/* One record after its ':', the cursor is left behind the checksum */
+static int parse_record(struct range *r, struct cursor *cur)
+{
+	struct ihex_chunk *chunk;
+	unsigned int len, addr, type, tmp, i, sum;
+	struct item *item;
+
+	if (get_hex_token(cur, 2, &len) < 0 ||
+	    get_hex_token(cur, 4, &addr) < 0 ||
+	    get_hex_token(cur, 2, &type) < 0)
+		goto err;
+
+	if (type == 1) {
+		if (get_hex_token(cur, 2, &tmp) < 0 || tmp != 0xff)
+			goto err;
+		return range_add(r, ITEM_END_OF_FILE, cur) ? 1 : -1;
+	}
+	if (type != 0)
+		goto err;
+
+	chunk = malloc(sizeof(*chunk) + len);
+	if (chunk == NULL) {
+		r->err_nomem = 1;
+		return -1;
+	}
+	memset(chunk, 0x00, sizeof(*chunk) + len);
+	chunk->len = len;
+	chunk->addr = addr;
+	chunk->line = cur->line;
+
+	for (i = 0; i < len; i++) {
+		if (get_hex_token(cur, 2, &tmp) < 0) {
+			free(chunk);
+			goto err;
+		}
+		chunk->data[i] = tmp;
+	}
+	if (get_hex_token(cur, 2, &tmp) < 0) {
+		free(chunk);
+		goto err;
+	}
+	chunk->checksum = tmp;
+
+	if (r->check_csum) {
+		sum = len + (addr >> 8) + addr + tmp;
+		for (i = 0; i < len; i++)
+			sum += chunk->data[i];
+		if (sum & 0xff) {
+			free(chunk);
+			cur->p -= 2;
+			range_error(r, cur);
+			r->err_csum = 1;
+			return -1;
+		}
+	}
+
+	item = range_add(r, ITEM_RECORD, cur);
+	if (item == NULL) {
+		free(chunk);
+		return -1;
+	}
+	item->chunk = chunk;
+
+	return 0;
+
+err:
+	range_error(r, cur);
+	return -1;
+}
+
+static void parse_range(struct range *r)
+{
+	struct cursor cur = { r->p, r->end, r->p, 1 };
+	struct item *item;
+	int c, ret;
+
+	while (cur.p < cur.end) {
+		c = (unsigned char)*cur.p;
+		switch (c) {
+		case '\n':
+			cur.p++;
+			cur.bol = cur.p;
+			cur.line++;
+			break;
+		case '\r':
+		case '\t':
+		case ' ':
+			cur.p++;
+			break;
+		case ':':
+			cur.p++;
+			ret = parse_record(r, &cur);
+			if (ret < 0 || (ret == 1 && r->stop_at_eof))
+				goto out;
+			break;
+		default:
+			/* Skip the rest of the line, it may be a comment */
+			item = range_add(r, ITEM_TEXT, &cur);
+			if (item == NULL)
+				goto out;
+			item->c = c;
+			while (cur.p < cur.end && *cur.p != '\n')
+				cur.p++;
+			break;
+		}
+	}
+
+out:
+	r->lines = cur.line - 1;
+}
+
+static void *parse_range_thread(void *arg)
+{
+	parse_range(arg);
+	return NULL;
+}
+
+static void range_free(struct range *r)
+{
+	unsigned int i;
+
+	for (i = 0; i < r->num; i++)
+		free(r->items[i].chunk);
+	free(r->items);
+	r->items = NULL;
+}
+
+static void file_append(struct ihex_file *file, struct ihex_chunk *chunk)
+{
+	if (file->last)
+		file->last->next = chunk;
+	else
+		file->first = chunk;
+	file->last = chunk;
+}
+
+static int bundle_add(struct ihex_bundle *bundle, unsigned int *size)
+{
+	struct ihex_file *tmp;
+
+	if (bundle->num == *size) {
+		*size = *size ? *size * 2 : 16;
+		tmp = realloc(bundle->files, *size * sizeof(*tmp));
+		if (tmp == NULL)
+			return -ENOMEM;
+		bundle->files = tmp;
+	}
+	bundle->files[bundle->num].first = NULL;
+	bundle->files[bundle->num].last = NULL;
+	bundle->num++;
+
+	return 0;
+}
+
+/*
+ * Walks the ranges in input order.  Records go to the current image, an
+ * end of file record closes it.  Text between images is ignored with
+ * skip_text, bundles may carry comments there, and an error otherwise.
+ */
+static int merge_ranges(struct range *ranges, unsigned int num,
+	struct ihex_bundle *bundle, unsigned int max_images, int skip_text)
+{
+	unsigned int r, i, base = 0, size = 0;
+	int open = 0, ret = 0;
+	struct item *item;
+
+	bundle->files = NULL;
+	bundle->num = 0;
+
+	for (r = 0; r < num && ret == 0; r++) {
+		for (i = 0; i < ranges[r].num; i++) {
+			item = &ranges[r].items[i];
+			if (item->type == ITEM_TEXT) {
+				if (!open && skip_text)
+					continue;
+				err_unexpected_char(item->c, base + item->line,
+					item->col);
+				ret = -EINVAL;
+				break;
+			}
+			if (!open) {
+				if (bundle->num == max_images)
+					break;
+				ret = bundle_add(bundle, &size);
+				if (ret < 0)
+					break;
+				open = 1;
+			}
+			if (item->type == ITEM_END_OF_FILE) {
+				open = 0;
+				continue;
+			}
+			item->chunk->line += base;
+			file_append(&bundle->files[bundle->num - 1], item->chunk);
+			item->chunk = NULL;
+		}
+		if (ret == 0 && i == ranges[r].num && ranges[r].err_nomem)
+			ret = -ENOMEM;
+		if (ret == 0 && i == ranges[r].num && ranges[r].err_csum) {
+			fprintf(stderr, "Bad record checksum at line %u(%u)\n",
+				base + ranges[r].err_line, ranges[r].err_col);
+			ret = -EINVAL;
+		} else if (ret == 0 && i == ranges[r].num && ranges[r].err_line) {
+			err_unexpected_char(ranges[r].err_c,
+				base + ranges[r].err_line, ranges[r].err_col);
+			ret = -EINVAL;
+		}
+		if (bundle->num == max_images && !open)
+			break;
+		base += ranges[r].lines;
+	}
+
+	/* An image without its end of file record is truncated */
+	if (ret == 0 && open) {
+		fprintf(stderr, "Missing end of file record at line %u\n", base);
+		ret = -EINVAL;
+	}
+	if (ret == 0 && bundle->num == 0) {
+		fprintf(stderr, "No records\n");
+		ret = -EINVAL;
+	}
+
+	for (r = 0; r < num; r++)
+		range_free(&ranges[r]);
+	if (ret < 0)
+		free_ihex_bundle(bundle);
+
+	return ret;
+}
+
+int parse_ihex_buf(const char *buf, size_t len, struct ihex_file *file)
+{
+	struct range r;
+	struct ihex_bundle bundle;
+	int ret;
+
+	file->first = NULL;
+	file->last = NULL;
+
+	memset(&r, 0x00, sizeof(r));
+	r.p = buf;
+	r.end = buf + len;
+	r.stop_at_eof = 1;
+	parse_range(&r);
+
+	ret = merge_ranges(&r, 1, &bundle, 1, 0);
+	if (ret < 0)
+		return ret;
+
+	*file = bundle.files[0];
+	free(bundle.files);
+
+	return 0;
+}
+
+int parse_ihex(int fd, struct ihex_file *file)
+{
+	char *buf = NULL, *tmp;
+	size_t len = 0, size = 0;
+	ssize_t ret;
+
+	do {
+		if (len == size) {
+			size = size ? size * 2 : 65536;
+			tmp = realloc(buf, size);
+			if (tmp == NULL) {
+				free(buf);
+				return -ENOMEM;
+			}
+			buf = tmp;
+		}
+		ret = read(fd, buf + len, size - len);
+		if (ret > 0)
+			len += ret;
+	} while (ret > 0 || (ret < 0 && errno == EINTR));
+
+	if (ret < 0) {
+		free(buf);
+		return -errno;
+	}
+
+	ret = parse_ihex_buf(buf, len, file);
+	free(buf);
+
+	return ret;
+}
+
+/*
+ * The input is cut into one range per thread at line starts, a record
+ * never spans lines.  Every range is parsed on its own, the merge then
+ * assigns the records to images and turns range relative line numbers
+ * into absolute ones.  Unlike parse_ihex() the record checksums are
+ * verified.
+ */
+int parse_ihex_bundle(const char *buf, size_t len, unsigned int threads,
+	struct ihex_bundle *bundle)
+{
+	struct range *ranges;
+	pthread_t *tids;
+	const char *p, *end = buf + len;
+	unsigned int i, started;
+	int ret;
+
+	if (threads == 0)
+		threads = 1;
+	/* Not worth a thread below 64 KiB */
+	if (len / threads < 65536)
+		threads = len / 65536 + 1;
+
+	ranges = calloc(threads, sizeof(*ranges));
+	tids = calloc(threads, sizeof(*tids));
+	if (ranges == NULL || tids == NULL) {
+		free(ranges);
+		free(tids);
+		return -ENOMEM;
+	}
+
+	for (i = 0, p = buf; i < threads; i++) {
+		ranges[i].p = p;
+		if (i == threads - 1) {
+			p = end;
+		} else {
+			p = buf + len / threads * (i + 1);
+			if (p < ranges[i].p)
+				p = ranges[i].p;
+			p = memchr(p, '\n', end - p);
+			p = p ? p + 1 : end;
+		}
+		ranges[i].end = p;
+		ranges[i].check_csum = 1;
+	}
+
+	for (started = 1; started < threads; started++) {
+		if (pthread_create(&tids[started], NULL, parse_range_thread,
+				   &ranges[started]))
+			break;
+	}
+	parse_range(&ranges[0]);
+	for (i = 1; i < threads; i++) {
+		if (i < started)
+			pthread_join(tids[i], NULL);
+		else
+			parse_range(&ranges[i]);
+	}
+	free(tids);
+
+	ret = merge_ranges(ranges, threads, bundle, ~0u, 1);
+	free(ranges);
+
+	return ret;
+}
+
+void free_ihex(struct ihex_file *file)
+{
+	struct ihex_chunk *chunk, *next;
+
+	for (chunk = file->first; chunk; chunk = next) {
+		next = chunk->next;
+		free(chunk);
+	}
+	file->first = NULL;
+	file->last = NULL;
+}
+
+void free_ihex_bundle(struct ihex_bundle *bundle)
+{
+	unsigned int i;
+
+	for (i = 0; i < bundle->num; i++)
+		free_ihex(&bundle->files[i]);
+	free(bundle->files);
+	bundle->files = NULL;
+	bundle->num = 0;
+}
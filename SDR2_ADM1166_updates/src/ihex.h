@@ -0,0 +1,48 @@
+/*
+ * Copyright (C) 2015-2016 Analog Devices, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * */
+
+#ifndef __IHEX_H__
+#define __IHEX_H__
+
+#include <stddef.h>
+
+struct ihex_chunk {
+	struct ihex_chunk *next;
+	unsigned int line;
+	unsigned short addr;
+	unsigned char len;
+	unsigned char checksum;
+	unsigned char data[];
+};
+
+struct ihex_file {
+	struct ihex_chunk *first;
+	struct ihex_chunk *last;
+};
+
+/* The images of a bundle, each ends with its end of file record */
+struct ihex_bundle {
+	struct ihex_file *files;
+	unsigned int num;
+};
+
+int parse_ihex(int fd, struct ihex_file *file);
+int parse_ihex_buf(const char *buf, size_t len, struct ihex_file *file);
+int parse_ihex_bundle(const char *buf, size_t len, unsigned int threads,
+	struct ihex_bundle *bundle);
+void free_ihex(struct ihex_file *file);
+void free_ihex_bundle(struct ihex_bundle *bundle);
+
+#endif
@@ -0,0 +1,272 @@
+/*
+ * Copyright (C) 2015-2016 Analog Devices, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "adm1166.h"
+#include "ihex.h"
+#include "proto.h"
+
+static int image_from_ihex(struct adm1166_image *img,
+	const struct ihex_file *file, const char *path)
+{
+	struct ihex_chunk *chunk;
+	unsigned int i, offset;
+
+	memset(img, 0x00, sizeof(*img));
+
+	for (chunk = file->first; chunk; chunk = chunk->next) {
+		if (chunk->addr < ADM1166_EEPROM_BASE ||
+		    chunk->addr + chunk->len >
+		    ADM1166_EEPROM_BASE + ADM1166_EEPROM_SIZE) {
+			fprintf(stderr, "%s:%u: record at %x outside of the EEPROM\n",
+				path, chunk->line, chunk->addr);
+			return -EINVAL;
+		}
+		offset = chunk->addr - ADM1166_EEPROM_BASE;
+		for (i = 0; i < chunk->len; i++) {
+			img->data[offset + i] = chunk->data[i];
+			img->valid[(offset + i) / 8] |= 1 << ((offset + i) % 8);
+		}
+	}
+
+	return 0;
+}
+
+int adm1166_image_load(struct adm1166_image *img, const char *path)
+{
+	struct ihex_file file;
+	int fd, ret;
+
+	memset(img, 0x00, sizeof(*img));
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		fprintf(stderr, "Failed to open %s: %d\n", path, errno);
+		return -errno;
+	}
+	ret = parse_ihex(fd, &file);
+	close(fd);
+
+	if (ret) {
+		fprintf(stderr, "Failed to parse ihex file \"%s\"\n", path);
+		free_ihex(&file);
+		return -EINVAL;
+	}
+
+	ret = image_from_ihex(img, &file, path);
+	free_ihex(&file);
+
+	return ret;
+}
+
+/*
+ * Loads every image of a bundle of concatenated ihex files, parsed on up
+ * to threads threads.  Returns the number of images, first_line (may be
+ * NULL) gets the line of the first record of each.
+ */
+int adm1166_bundle_load(const char *path, unsigned int threads,
+	struct adm1166_image **imgs, unsigned int **first_line)
+{
+	struct ihex_bundle bundle;
+	struct stat st;
+	unsigned int i;
+	char *buf;
+	int fd, ret;
+
+	*imgs = NULL;
+	if (first_line)
+		*first_line = NULL;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		fprintf(stderr, "Failed to open %s: %d\n", path, errno);
+		return -errno;
+	}
+	if (fstat(fd, &st) < 0) {
+		close(fd);
+		return -errno;
+	}
+	buf = mmap(NULL, st.st_size ? st.st_size : 1, PROT_READ, MAP_PRIVATE,
+		fd, 0);
+	close(fd);
+	if (buf == MAP_FAILED)
+		return -errno;
+
+	ret = parse_ihex_bundle(buf, st.st_size, threads, &bundle);
+	munmap(buf, st.st_size ? st.st_size : 1);
+	if (ret < 0) {
+		fprintf(stderr, "Failed to parse ihex bundle \"%s\"\n", path);
+		return ret;
+	}
+
+	*imgs = malloc(bundle.num * sizeof(**imgs));
+	if (first_line)
+		*first_line = malloc(bundle.num * sizeof(**first_line));
+	if (*imgs == NULL || (first_line && *first_line == NULL)) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	for (i = 0; i < bundle.num; i++) {
+		ret = image_from_ihex(&(*imgs)[i], &bundle.files[i], path);
+		if (ret < 0)
+			goto out;
+		if (first_line)
+			(*first_line)[i] = bundle.files[i].first ?
+				bundle.files[i].first->line : 0;
+	}
+	ret = bundle.num;
+
+out:
+	free_ihex_bundle(&bundle);
+	if (ret < 0) {
+		free(*imgs);
+		*imgs = NULL;
+		if (first_line) {
+			free(*first_line);
+			*first_line = NULL;
+		}
+	}
+
+	return ret;
+}
+
+int adm1166_image_read(struct adm1166 *dev, struct adm1166_image *img)
+{
+	unsigned int addr;
+	int ret;
+
+	for (addr = 0; addr < ADM1166_EEPROM_SIZE; addr += ADM1166_PAGE_SIZE) {
+		ret = adm1166_eeprom_read(dev, ADM1166_EEPROM_BASE + addr,
+			img->data + addr);
+		if (ret < 0)
+			return ret;
+	}
+	memset(img->valid, 0xff, sizeof(img->valid));
+
+	return 0;
+}
+
+int adm1166_image_valid(const struct adm1166_image *img, unsigned int off)
+{
+	return img->valid[off / 8] & (1 << (off % 8));
+}
+
+/* Runs of valid bytes: offset from the end of the previous run, length, data */
+int adm1166_image_encode(struct proto_buf *b, const struct adm1166_image *img)
+{
+	unsigned int off, len, prev = 0, runs = 0;
+	int ret;
+
+	for (off = 0; off < ADM1166_EEPROM_SIZE; off++) {
+		if (adm1166_image_valid(img, off) &&
+		    (off == 0 || !adm1166_image_valid(img, off - 1)))
+			runs++;
+	}
+
+	ret = proto_put_varint(b, runs);
+	for (off = 0; off < ADM1166_EEPROM_SIZE && ret == 0; off += len) {
+		if (!adm1166_image_valid(img, off)) {
+			len = 1;
+			continue;
+		}
+		for (len = 1; off + len < ADM1166_EEPROM_SIZE &&
+		     adm1166_image_valid(img, off + len); len++)
+			;
+		ret = proto_put_varint(b, off - prev);
+		if (ret == 0)
+			ret = proto_put_varint(b, len);
+		if (ret == 0)
+			ret = proto_put_bytes(b, img->data + off, len);
+		prev = off + len;
+	}
+
+	return ret;
+}
+
+int adm1166_image_decode(const unsigned char **p, const unsigned char *end,
+	struct adm1166_image *img)
+{
+	unsigned long long runs, skip, len;
+	unsigned int off = 0, i;
+
+	memset(img, 0x00, sizeof(*img));
+
+	if (proto_get_varint(p, end, &runs) < 0)
+		return -EINVAL;
+	while (runs--) {
+		if (proto_get_varint(p, end, &skip) < 0 ||
+		    proto_get_varint(p, end, &len) < 0 ||
+		    skip + len > ADM1166_EEPROM_SIZE - off ||
+		    len > (unsigned long long)(end - *p))
+			return -EINVAL;
+		off += skip;
+		memcpy(img->data + off, *p, len);
+		for (i = off; i < off + len; i++)
+			img->valid[i / 8] |= 1 << (i % 8);
+		*p += len;
+		off += len;
+	}
+
+	return 0;
+}
+
+void adm1166_se_decode(const unsigned char *buf, struct adm1166_se_state *st)
+{
+	st->pdo = buf[0] | ((buf[1] & 0x03) << 8);
+	st->monitor_mask = buf[2] | ((buf[3] & 0x03) << 8);
+	st->seq_sel = buf[4] >> 3;
+	st->timer = (buf[4] & 0x07) | ((buf[5] & 0x0f) << 3);
+	st->next_monitor = (buf[5] >> 4) | ((buf[6] & 0x03) << 4);
+	st->next_timeout = buf[6] >> 2;
+	st->next_seq = buf[7] & 0x3f;
+}
+
+/*
+ * States the engine can get to from state 0, where it starts after reset
+ * and after an EEPROM download.  An edge only counts when it can fire:
+ * sequence with a condition selected, timeout with the timer running and
+ * monitor with a supply monitored.  Bit n is set for state n.
+ */
+unsigned long long adm1166_se_reachable(const unsigned char *se)
+{
+	unsigned int todo[ADM1166_SE_STATES], n = 0, i, next[3];
+	unsigned long long reach = 1;
+	struct adm1166_se_state st;
+
+	todo[n++] = 0;
+	while (n) {
+		adm1166_se_decode(se + 8 * todo[--n], &st);
+		next[0] = st.seq_sel ? st.next_seq : 0;
+		next[1] = st.timer ? st.next_timeout : 0;
+		next[2] = st.monitor_mask ? st.next_monitor : 0;
+		for (i = 0; i < 3; i++) {
+			if (reach & (1ULL << next[i]))
+				continue;
+			reach |= 1ULL << next[i];
+			todo[n++] = next[i];
+		}
+	}
+
+	return reach;
+}
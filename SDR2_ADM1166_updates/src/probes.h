@@ -0,0 +1,48 @@
+/*
+ * Copyright (C) 2015-2016 Analog Devices, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * */
+
+#ifndef __PROBES_H__
+#define __PROBES_H__
+
+/*
+ * USDT probes of provider "adm1166" for perf and bpftrace, e.g.
+ *
+ *   bpftrace -e 'usdt:./adm1166_eeprom:adm1166:page__write__entry
+ *                { printf("%x\n", arg2); }'
+ *
+ * With <sys/sdt.h> (systemtap-sdt-dev) every probe is a single nop until
+ * a tracer attaches, without it they compile to nothing.  In the first
+ * case the arguments are evaluated on every call, traced or not, so only
+ * values that are at hand are passed: xfer__entry passes the i2c_msg
+ * array and the tracer reads the lengths from it.
+ */
+#if defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define ADM1166_HAVE_SDT
+#endif
+#endif
+
+#ifdef ADM1166_HAVE_SDT
+#define PROBE3(name, a, b, c)		DTRACE_PROBE3(adm1166, name, a, b, c)
+#define PROBE4(name, a, b, c, d)	DTRACE_PROBE4(adm1166, name, a, b, c, d)
+#define PROBE5(name, a, b, c, d, e)	DTRACE_PROBE5(adm1166, name, a, b, c, d, e)
+#else
+#define PROBE3(name, a, b, c)		do { } while (0)
+#define PROBE4(name, a, b, c, d)	do { } while (0)
+#define PROBE5(name, a, b, c, d, e)	do { } while (0)
+#endif
+
+#endif
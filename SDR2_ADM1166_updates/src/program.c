@@ -0,0 +1,716 @@
+/*
+ * Copyright (C) 2015-2016 Analog Devices, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * */
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "adm1166.h"
+#include "probes.h"
+
+#define UPDCFG_EEPROM_ACCESS	(ADM1166_UPDCFG_EEPROM_EN | 0x01)
+#define PROGRAM_RETRIES		3
+
+/*
+ * Stored checksums over the bytes in [start, end), the checksum bytes
+ * themselves left out.  Only the user sum is known to be the complement
+ * sum, it runs one byte into the sequence engine, that is what the values
+ * stored by the Windows tool add up to.  The other two follow a different
+ * formula, the scrubber takes them as a baseline.
+ */
+static const struct {
+	unsigned int start;
+	unsigned int end;
+	unsigned int addr;
+	unsigned int len;
+} adm1166_csums[] = {
+	{ ADM1166_EEPROM_BASE, ADM1166_USER_BASE, ADM1166_EE_CFG_CSUM, 2 },
+	{ ADM1166_USER_BASE, ADM1166_SE_BASE + 1, ADM1166_EE_USER_CSUM, 2 },
+	{ ADM1166_SE_BASE, ADM1166_EEPROM_BASE + ADM1166_EEPROM_SIZE,
+	  ADM1166_EE_SE_CSUM, 3 },
+};
+
+static int page_touched(const struct adm1166_image *img, unsigned int page)
+{
+	unsigned int i;
+
+	for (i = 0; i < ADM1166_PAGE_SIZE / 8; i++) {
+		if (img->valid[page * ADM1166_PAGE_SIZE / 8 + i])
+			return 1;
+	}
+
+	return 0;
+}
+
+/* The original programmer never touched the last 0x60 bytes of a block */
+int adm1166_page_reserved(unsigned int addr)
+{
+	return (addr & 0xff) >= 0xa0;
+}
+
+/* Loaded pages are marked valid in plan->image */
+static int plan_load(struct adm1166 *dev, struct adm1166_plan *plan,
+	unsigned int page, FILE *log)
+{
+	unsigned int off = page * ADM1166_PAGE_SIZE;
+	int ret;
+
+	if (page_touched(&plan->image, page))
+		return 0;
+
+	if (log)
+		fprintf(log, "Reading %4x ... ", ADM1166_EEPROM_BASE + off);
+	ret = adm1166_eeprom_read(dev, ADM1166_EEPROM_BASE + off, plan->old + off);
+	if (log)
+		fprintf(log, "%s\n", ret < 0 ? "failed" : "success");
+	if (ret < 0)
+		return ret;
+
+	memcpy(plan->image.data + off, plan->old + off, ADM1166_PAGE_SIZE);
+	memset(plan->image.valid + off / 8, 0xff, ADM1166_PAGE_SIZE / 8);
+
+	return 0;
+}
+
+/*
+ * Only the user checksum is known to follow the complement sum, the
+ * configuration and sequence engine checksums must come with the image
+ * when it changes what they cover.
+ */
+static int plan_checksums(struct adm1166_plan *plan,
+	const struct adm1166_image *img, struct adm1166 *dev, FILE *log)
+{
+	unsigned int c, i, off, val, supplied;
+	int delta, ret;
+
+	for (c = 0; c < sizeof(adm1166_csums) / sizeof(adm1166_csums[0]); c++) {
+		off = adm1166_csums[c].addr - ADM1166_EEPROM_BASE;
+
+		/* An image that brings its own checksum is taken as is */
+		for (i = 0, supplied = 1; i < adm1166_csums[c].len; i++)
+			supplied &= !!adm1166_image_valid(img, off + i);
+		if (supplied)
+			continue;
+
+		delta = 0;
+		for (i = adm1166_csums[c].start - ADM1166_EEPROM_BASE;
+		     i < adm1166_csums[c].end - ADM1166_EEPROM_BASE; i++) {
+			if (i + ADM1166_EEPROM_BASE >= ADM1166_EE_CFG_CSUM &&
+			    i + ADM1166_EEPROM_BASE <= ADM1166_EE_DEVICE_ID)
+				continue;
+			if (adm1166_image_valid(&plan->image, i))
+				delta += plan->old[i] - plan->image.data[i];
+		}
+		if (delta == 0)
+			continue;
+
+		if (adm1166_csums[c].addr != ADM1166_EE_USER_CSUM) {
+			fprintf(stderr, "Image changes %x-%x without the checksum "
+				"at %x\n", adm1166_csums[c].start,
+				adm1166_csums[c].end - 1, adm1166_csums[c].addr);
+			return -EINVAL;
+		}
+
+		ret = plan_load(dev, plan, off / ADM1166_PAGE_SIZE, log);
+		if (ret < 0)
+			return ret;
+
+		for (i = 0, val = 0; i < adm1166_csums[c].len; i++)
+			val |= plan->old[off + i] << (8 * i);
+		val += delta;
+		for (i = 0; i < adm1166_csums[c].len; i++)
+			plan->image.data[off + i] = val >> (8 * i);
+	}
+
+	return 0;
+}
+
+#define SE_OFF		(ADM1166_SE_BASE - ADM1166_EEPROM_BASE)
+#define SE_STATE(off)	(((off) - SE_OFF) / 8)
+
+static int se_touched(const struct adm1166_image *img)
+{
+	unsigned int page;
+
+	for (page = SE_OFF / ADM1166_PAGE_SIZE; page < ADM1166_NUM_PAGES; page++) {
+		if (page_touched(img, page))
+			return 1;
+	}
+
+	return 0;
+}
+
+/*
+ * States the engine reaches on the table in data.  The pages of reached
+ * states that are not in *loaded yet are read as the walk gets there,
+ * reserved ones too: they are never written, but the engine runs through
+ * them all the same.  A copy of every page read goes to copy if given.
+ */
+static int se_reach(struct adm1166 *dev, unsigned char *data,
+	unsigned char *copy, unsigned long long *loaded,
+	unsigned long long *reach, FILE *log)
+{
+	unsigned int page, off, more;
+	int ret;
+
+	do {
+		*reach = adm1166_se_reachable(data + SE_OFF);
+		more = 0;
+		for (page = SE_OFF / ADM1166_PAGE_SIZE;
+		     page < ADM1166_NUM_PAGES; page++) {
+			off = page * ADM1166_PAGE_SIZE;
+			if (*loaded & (1ULL << page) ||
+			    !(*reach >> SE_STATE(off) & 0xf))
+				continue;
+			if (log)
+				fprintf(log, "Reading %4x ... ",
+					ADM1166_EEPROM_BASE + off);
+			ret = adm1166_eeprom_read(dev, ADM1166_EEPROM_BASE + off,
+				data + off);
+			if (log)
+				fprintf(log, "%s\n", ret < 0 ? "failed" : "success");
+			if (ret < 0)
+				return ret;
+			if (copy)
+				memcpy(copy + off, data + off, ADM1166_PAGE_SIZE);
+			*loaded |= 1ULL << page;
+			more = 1;
+		}
+	} while (more);
+
+	return 0;
+}
+
+/*
+ * States the engine cannot reach are don't-care: a sequence engine page
+ * whose changes all fall into such states keeps what the device holds.
+ * Only done when some page changes, the walk then reads the untouched
+ * pages the engine runs through.  A sequence engine checksum the image
+ * supplies is written as it is either way.
+ */
+static int plan_se_states(struct adm1166 *dev, struct adm1166_plan *plan,
+	FILE *log)
+{
+	unsigned long long reach, loaded = 0, changed = 0;
+	unsigned int page, off, i, n;
+	int ret;
+
+	for (page = SE_OFF / ADM1166_PAGE_SIZE; page < ADM1166_NUM_PAGES; page++) {
+		off = page * ADM1166_PAGE_SIZE;
+		if (!page_touched(&plan->image, page))
+			continue;
+		loaded |= 1ULL << page;
+		if (memcmp(plan->image.data + off, plan->old + off,
+			   ADM1166_PAGE_SIZE))
+			changed |= 1ULL << page;
+	}
+	if (changed == 0)
+		return 0;
+
+	ret = se_reach(dev, plan->image.data, plan->old, &loaded, &reach, log);
+	if (ret < 0)
+		return ret;
+
+	for (page = SE_OFF / ADM1166_PAGE_SIZE; page < ADM1166_NUM_PAGES; page++) {
+		off = page * ADM1166_PAGE_SIZE;
+		if (loaded & (1ULL << page))
+			memset(plan->image.valid + off / 8, 0xff,
+			       ADM1166_PAGE_SIZE / 8);
+		if (!adm1166_page_reserved(ADM1166_EEPROM_BASE + off) ||
+		    !(reach >> SE_STATE(off) & 0xf) || log == NULL)
+			continue;
+		fprintf(log, "Note: reserved page %x holds reachable states",
+			ADM1166_EEPROM_BASE + off);
+		for (n = SE_STATE(off); n < SE_STATE(off) + 4; n++) {
+			if (reach & (1ULL << n))
+				fprintf(log, " %u", n);
+		}
+		fprintf(log, ", it is never written\n");
+	}
+
+	for (page = SE_OFF / ADM1166_PAGE_SIZE; page < ADM1166_NUM_PAGES; page++) {
+		off = page * ADM1166_PAGE_SIZE;
+		if (!(changed & (1ULL << page)))
+			continue;
+		for (i = off; i < off + ADM1166_PAGE_SIZE; i++) {
+			if (plan->image.data[i] != plan->old[i] &&
+			    reach & (1ULL << SE_STATE(i)))
+				break;
+		}
+		if (i < off + ADM1166_PAGE_SIZE)
+			continue;
+		memcpy(plan->image.data + off, plan->old + off, ADM1166_PAGE_SIZE);
+		if (log)
+			fprintf(log, "Page %x only changes unreachable states, "
+				"kept\n", ADM1166_EEPROM_BASE + off);
+	}
+
+	return 0;
+}
+
+/*
+ * Reads every page the image touches exactly once, merges the image into
+ * it and updates the stored user checksum incrementally from the bytes
+ * that changed.  Only pages whose contents differ end up in plan->pages.
+ */
+int adm1166_plan(struct adm1166 *dev, const struct adm1166_image *img,
+	struct adm1166_plan *plan, FILE *log)
+{
+	unsigned int page, off, i;
+	int ret;
+
+	memset(plan, 0x00, sizeof(*plan));
+
+	for (page = 0; page < ADM1166_NUM_PAGES; page++) {
+		off = page * ADM1166_PAGE_SIZE;
+		if (!page_touched(img, page))
+			continue;
+		if (adm1166_page_reserved(ADM1166_EEPROM_BASE + off)) {
+			if (log)
+				fprintf(log, "Skipping reserved page %x\n",
+					ADM1166_EEPROM_BASE + off);
+			continue;
+		}
+
+		ret = plan_load(dev, plan, page, log);
+		if (ret < 0)
+			return ret;
+
+		for (i = off; i < off + ADM1166_PAGE_SIZE; i++) {
+			if (adm1166_image_valid(img, i))
+				plan->image.data[i] = img->data[i];
+		}
+	}
+
+	ret = plan_se_states(dev, plan, log);
+	if (ret < 0)
+		return ret;
+
+	ret = plan_checksums(plan, img, dev, log);
+	if (ret < 0)
+		return ret;
+
+	for (page = 0; page < ADM1166_NUM_PAGES; page++) {
+		off = page * ADM1166_PAGE_SIZE;
+		if (!page_touched(&plan->image, page) ||
+		    memcmp(plan->old + off, plan->image.data + off,
+			   ADM1166_PAGE_SIZE) == 0)
+			continue;
+		plan->pages[plan->num_pages++] = ADM1166_EEPROM_BASE + off;
+	}
+
+	return 0;
+}
+
+static int program_page(struct adm1166 *dev, unsigned int addr,
+	const unsigned char *data, FILE *log)
+{
+	unsigned char rbuf[ADM1166_PAGE_SIZE];
+	int ret;
+
+	if (log)
+		fprintf(log, "Erasing %4x ... ", addr);
+	ret = adm1166_eeprom_erase(dev, addr);
+	if (log)
+		fprintf(log, "%s\n", ret < 0 ? "failed" : "success");
+	if (ret < 0)
+		return ret;
+	sleep(1);
+
+	if (log)
+		fprintf(log, "Writing %4x ... ", addr);
+	ret = adm1166_eeprom_write(dev, addr, data);
+	if (log)
+		fprintf(log, "%s\n", ret < 0 ? "failed" : "success");
+	if (ret < 0)
+		return ret;
+	sleep(1);
+
+	if (log)
+		fprintf(log, "Verifying %4x ... ", addr);
+	PROBE3(page__verify__entry, dev->bus, dev->addr, addr);
+	ret = adm1166_eeprom_read(dev, addr, rbuf);
+	if (ret == 0 && memcmp(rbuf, data, ADM1166_PAGE_SIZE) != 0)
+		ret = -EIO;
+	PROBE4(page__verify__return, dev->bus, dev->addr, addr, ret);
+	if (log)
+		fprintf(log, "%s\n", ret < 0 ? "failed" : "success");
+
+	return ret;
+}
+
+/*
+ * Erases and writes the planned pages with the sequence engine halted.
+ * The engine is left halted, the new configuration is not active yet.
+ */
+int adm1166_plan_execute(struct adm1166 *dev, const struct adm1166_plan *plan,
+	FILE *log)
+{
+	unsigned int i, retry;
+	int ret = 0;
+
+	if (plan->num_pages == 0)
+		return 0;
+
+	ret = adm1166_reg_write(dev, ADM1166_REG_SECTRL, ADM1166_SECTRL_HALT);
+	if (ret < 0)
+		return ret;
+	ret = adm1166_reg_write(dev, ADM1166_REG_UPDCFG, UPDCFG_EEPROM_ACCESS);
+	if (ret < 0)
+		return ret;
+
+	for (i = 0; i < plan->num_pages; i++) {
+		retry = 0;
+		do {
+			if (retry != 0 && log)
+				fprintf(log, "Failed to program page %x, retry (%d).\n",
+					plan->pages[i], retry);
+			retry++;
+			ret = program_page(dev, plan->pages[i], plan->image.data +
+				plan->pages[i] - ADM1166_EEPROM_BASE, log);
+			PROBE5(page__retry, dev->bus, dev->addr, plan->pages[i],
+				retry, ret);
+		} while (ret != 0 && retry < PROGRAM_RETRIES);
+
+		if (ret != 0)
+			break;
+	}
+
+	/* Back to normal mode */
+	adm1166_reg_write(dev, ADM1166_REG_UPDCFG, 0);
+
+	return ret;
+}
+
+/* Thresholds, DACs, limits and the readback setup take effect on the fly */
+static int reg_live_safe(unsigned int reg)
+{
+	if (reg < 8 * ADM1166_NUM_SFDS)
+		return reg % 8 < 4;
+	if (reg >= ADM1166_REG_DACCTRL(1) && reg < 0x7d)
+		return 1;
+	return reg >= ADM1166_REG_RRSEL1 && reg <= ADM1166_REG_TSCTRL;
+}
+
+/* Limits before the DAC codes they clamp, DAC enables last */
+static int reg_live_order(unsigned int reg)
+{
+	if (reg >= ADM1166_REG_DPLIM(1) && reg <= ADM1166_REG_DNLIM(ADM1166_NUM_DACS))
+		return 0;
+	if (reg >= ADM1166_REG_DACCTRL(1) &&
+	    reg <= ADM1166_REG_DACCTRL(ADM1166_NUM_DACS))
+		return 2;
+	return 1;
+}
+
+static void print_pdos(FILE *log, unsigned int pdos)
+{
+	unsigned int i;
+
+	for (i = 0; i < 10; i++) {
+		if (pdos & (1 << i))
+			fprintf(log, " PDO%u", i + 1);
+	}
+	fprintf(log, "\n");
+}
+
+/*
+ * Brings the configuration programmed by adm1166_plan_execute() into
+ * effect without a power cycle.  When only live-safe registers differ from
+ * the new EEPROM contents they are written directly and the halted
+ * sequence engine resumes where it was.  Anything else (SFD and PDO setup,
+ * sequence engine states) needs an EEPROM download, which restarts the
+ * sequence engine from state 0; the PDOs that change are reported.
+ */
+int adm1166_activate(struct adm1166 *dev, const struct adm1166_plan *plan,
+	FILE *log)
+{
+	unsigned char live[ADM1166_NUM_REGS], cfg[5 * ADM1166_PAGE_SIZE];
+	struct adm1166_se_state old, new;
+	unsigned int reg, i, off, pass, pdos = 0, changed = 0;
+	int restart = 0;
+	int ret;
+
+	/* Config pages the plan did not touch still have to be compared */
+	for (off = 0; off < sizeof(cfg); off += ADM1166_PAGE_SIZE) {
+		if (page_touched(&plan->image, off / ADM1166_PAGE_SIZE)) {
+			memcpy(cfg + off, plan->image.data + off, ADM1166_PAGE_SIZE);
+			continue;
+		}
+		ret = adm1166_eeprom_read(dev, ADM1166_EEPROM_BASE + off, cfg + off);
+		if (ret < 0)
+			return ret;
+	}
+
+	ret = adm1166_regs_read(dev, 0, live, sizeof(live));
+	if (ret < 0)
+		return ret;
+
+	for (reg = 0; reg < ADM1166_NUM_REGS; reg++) {
+		if (reg == ADM1166_REG_UPDCFG || reg == ADM1166_REG_SECTRL ||
+		    (reg >= ADM1166_EE_CFG_CSUM - ADM1166_EEPROM_BASE &&
+		     reg <= ADM1166_EE_DEVICE_ID - ADM1166_EEPROM_BASE) ||
+		    live[reg] == cfg[reg])
+			continue;
+		changed++;
+		if (reg_live_safe(reg))
+			continue;
+		restart = 1;
+		if (reg < 8 * ADM1166_NUM_SFDS && reg % 8 == 7)
+			pdos |= 1 << (reg / 8);
+		if (log)
+			fprintf(log, "%s changes from %02x to %02x\n",
+				adm1166_reg_name(reg), live[reg], cfg[reg]);
+	}
+
+	for (i = 0; i < ADM1166_SE_STATES; i++) {
+		off = ADM1166_SE_BASE - ADM1166_EEPROM_BASE + 8 * i;
+		if (!adm1166_image_valid(&plan->image, off) ||
+		    memcmp(plan->old + off, plan->image.data + off, 8) == 0)
+			continue;
+		adm1166_se_decode(plan->old + off, &old);
+		adm1166_se_decode(plan->image.data + off, &new);
+		pdos |= old.pdo ^ new.pdo;
+		restart = 1;
+		if (log)
+			fprintf(log, "State%u changes\n", i);
+	}
+
+	if (restart) {
+		if (log) {
+			fprintf(log, "Restarting the sequence engine, affected:");
+			print_pdos(log, pdos);
+		}
+		return adm1166_eeprom_download(dev);
+	}
+
+	for (pass = 0; pass < 3; pass++) {
+		for (reg = 0; reg < ADM1166_NUM_REGS; reg++) {
+			if (live[reg] == cfg[reg] || !reg_live_safe(reg) ||
+			    reg_live_order(reg) != pass)
+				continue;
+			ret = adm1166_reg_write(dev, reg, cfg[reg]);
+			if (ret < 0)
+				return ret;
+		}
+	}
+	if (log)
+		fprintf(log, "Updated %u registers live\n", changed);
+
+	return adm1166_reg_write(dev, ADM1166_REG_SECTRL, 0);
+}
+
+/*
+ * Compares the EEPROM with the bytes the image covers, reserved pages are
+ * skipped as the planner skips them, and so are the states the engine on
+ * the device cannot reach.  The walk reads the pages the engine runs
+ * through the way the planner does.  Returns the number of bytes that
+ * differ, *first is the address of the first one.
+ */
+int adm1166_verify(struct adm1166 *dev, const struct adm1166_image *img,
+	unsigned int *first)
+{
+	unsigned char data[ADM1166_EEPROM_SIZE];
+	unsigned long long reach = ~0ULL, loaded = 0;
+	unsigned int page, off, i, bad = 0;
+	int ret;
+
+	*first = 0;
+	memset(data, 0x00, sizeof(data));
+
+	for (page = 0; page < ADM1166_NUM_PAGES; page++) {
+		off = page * ADM1166_PAGE_SIZE;
+		if (!page_touched(img, page) ||
+		    adm1166_page_reserved(ADM1166_EEPROM_BASE + off))
+			continue;
+		ret = adm1166_eeprom_read(dev, ADM1166_EEPROM_BASE + off,
+			data + off);
+		if (ret < 0)
+			return ret;
+		loaded |= 1ULL << page;
+	}
+	if (se_touched(img)) {
+		ret = se_reach(dev, data, NULL, &loaded, &reach, NULL);
+		if (ret < 0)
+			return ret;
+	}
+
+	for (page = 0; page < ADM1166_NUM_PAGES; page++) {
+		off = page * ADM1166_PAGE_SIZE;
+		if (!page_touched(img, page) ||
+		    adm1166_page_reserved(ADM1166_EEPROM_BASE + off))
+			continue;
+		for (i = off; i < off + ADM1166_PAGE_SIZE; i++) {
+			if (!adm1166_image_valid(img, i) || data[i] == img->data[i] ||
+			    (i >= SE_OFF && !(reach & (1ULL << SE_STATE(i)))))
+				continue;
+			if (bad++ == 0)
+				*first = ADM1166_EEPROM_BASE + i;
+		}
+	}
+
+	return bad;
+}
+
+static int scrub_byte(unsigned int off)
+{
+	unsigned int addr = ADM1166_EEPROM_BASE + off;
+
+	/* Checksums and device ID are rewritten by the planner */
+	return !(addr >= ADM1166_EE_CFG_CSUM && addr <= ADM1166_EE_DEVICE_ID);
+}
+
+static unsigned long csum_compute(const unsigned char *data, unsigned int c)
+{
+	unsigned long sum = 0;
+	unsigned int i;
+
+	for (i = adm1166_csums[c].start - ADM1166_EEPROM_BASE;
+	     i < adm1166_csums[c].end - ADM1166_EEPROM_BASE; i++) {
+		if (scrub_byte(i))
+			sum += 0xff - data[i];
+	}
+
+	return sum & ((1UL << (8 * adm1166_csums[c].len)) - 1);
+}
+
+static unsigned long csum_stored(const unsigned char *data, unsigned int c)
+{
+	unsigned int off = adm1166_csums[c].addr - ADM1166_EEPROM_BASE, i;
+	unsigned long val = 0;
+
+	for (i = 0; i < adm1166_csums[c].len; i++)
+		val |= (unsigned long)data[off + i] << (8 * i);
+
+	return val;
+}
+
+/*
+ * Only what the programmer writes is compared against the reference: the
+ * pages it supplies outside the user EEPROM, less the reserved ones.
+ * Checksum passes read every page.
+ */
+void adm1166_scrub_init(struct adm1166_scrub *scrub,
+	const struct adm1166_image *ref)
+{
+	unsigned long long reach;
+	unsigned int page, addr, i;
+
+	memset(scrub, 0x00, sizeof(*scrub));
+
+	if (ref) {
+		scrub->ref = *ref;
+		scrub->use_ref = 1;
+	}
+
+	/* States the reference cannot reach may hold anything */
+	for (i = SE_OFF; ref && i < ADM1166_EEPROM_SIZE &&
+	     adm1166_image_valid(ref, i); i++)
+		;
+	if (ref && i == ADM1166_EEPROM_SIZE) {
+		reach = adm1166_se_reachable(ref->data + SE_OFF);
+		for (i = SE_OFF; i < ADM1166_EEPROM_SIZE; i++) {
+			if (!(reach & (1ULL << SE_STATE(i))))
+				scrub->ref.valid[i / 8] &= ~(1 << (i % 8));
+		}
+	}
+
+	for (page = 0; page < ADM1166_NUM_PAGES; page++) {
+		addr = ADM1166_EEPROM_BASE + page * ADM1166_PAGE_SIZE;
+		if (ref && (!page_touched(&scrub->ref, page) ||
+		    adm1166_page_reserved(addr) ||
+		    (addr >= ADM1166_USER_BASE && addr < ADM1166_SE_BASE)))
+			continue;
+		scrub->pages[scrub->num_pages++] = addr;
+	}
+}
+
+static int scrub_page(const struct adm1166_scrub *scrub, unsigned int off)
+{
+	unsigned int i;
+	int bad = 0;
+
+	for (i = off; i < off + ADM1166_PAGE_SIZE; i++) {
+		if (adm1166_image_valid(&scrub->ref, i) && scrub_byte(i) &&
+		    scrub->data[i] != scrub->ref.data[i])
+			bad++;
+	}
+
+	return bad;
+}
+
+static int scrub_csums(struct adm1166_scrub *scrub, unsigned int *addr)
+{
+	unsigned long sum;
+	unsigned int c;
+	int bad = 0;
+
+	for (c = 0; c < ADM1166_NUM_CSUMS; c++) {
+		sum = csum_compute(scrub->data, c);
+		if (scrub->passes == 0 && sum != csum_stored(scrub->data, c)) {
+			scrub->use_baseline |= 1 << c;
+			scrub->baseline[c] = sum;
+		}
+		if (sum == (scrub->use_baseline & (1 << c) ? scrub->baseline[c] :
+			    csum_stored(scrub->data, c)))
+			continue;
+		if (bad++ == 0)
+			*addr = adm1166_csums[c].addr;
+	}
+
+	return bad;
+}
+
+/*
+ * Reads the next page of the pass.  Returns the number of bytes that
+ * differ from the reference, with the page in *addr, a page that differs
+ * is read a second time first so a bus glitch does not raise an alarm.
+ * In checksum mode the number of bad checksums at the end of each pass,
+ * with the address of the first in *addr.
+ */
+int adm1166_scrub_step(struct adm1166 *dev, struct adm1166_scrub *scrub,
+	unsigned int *addr)
+{
+	unsigned int page = scrub->pages[scrub->next];
+	unsigned int off = page - ADM1166_EEPROM_BASE;
+	int ret;
+
+	if (scrub->num_pages == 0)
+		return 0;
+
+	ret = adm1166_eeprom_read(dev, page, scrub->data + off);
+	PROBE4(scrub__page, dev->bus, dev->addr, page, ret);
+	if (ret < 0)
+		return ret;
+
+	if (scrub->use_ref && scrub_page(scrub, off)) {
+		ret = adm1166_eeprom_read(dev, page, scrub->data + off);
+		if (ret < 0)
+			return ret;
+		ret = scrub_page(scrub, off);
+		*addr = page;
+	}
+
+	if (++scrub->next < scrub->num_pages)
+		return ret;
+
+	scrub->next = 0;
+	if (!scrub->use_ref)
+		ret = scrub_csums(scrub, addr);
+	scrub->passes++;
+
+	return ret;
+}
@@ -0,0 +1,378 @@
+/*
+ * Copyright (C) 2015-2016 Analog Devices, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+
+#include "proto.h"
+
+void proto_buf_free(struct proto_buf *b)
+{
+	free(b->data);
+	b->data = NULL;
+	b->len = 0;
+	b->size = 0;
+}
+
+static int proto_reserve(struct proto_buf *b, size_t len)
+{
+	unsigned char *tmp;
+	size_t size;
+
+	if (b->len + len <= b->size)
+		return 0;
+
+	size = b->size ? b->size : 256;
+	while (size < b->len + len)
+		size *= 2;
+	tmp = realloc(b->data, size);
+	if (tmp == NULL)
+		return -ENOMEM;
+	b->data = tmp;
+	b->size = size;
+
+	return 0;
+}
+
+int proto_put_bytes(struct proto_buf *b, const void *data, size_t len)
+{
+	if (proto_reserve(b, len) < 0)
+		return -ENOMEM;
+	memcpy(b->data + b->len, data, len);
+	b->len += len;
+
+	return 0;
+}
+
+int proto_put_varint(struct proto_buf *b, unsigned long long v)
+{
+	if (proto_reserve(b, 10) < 0)
+		return -ENOMEM;
+
+	while (v >= 0x80) {
+		b->data[b->len++] = (v & 0x7f) | 0x80;
+		v >>= 7;
+	}
+	b->data[b->len++] = v;
+
+	return 0;
+}
+
+int proto_put_svarint(struct proto_buf *b, long long v)
+{
+	return proto_put_varint(b, ((unsigned long long)v << 1) ^ (v >> 63));
+}
+
+int proto_get_varint(const unsigned char **p, const unsigned char *end,
+	unsigned long long *v)
+{
+	unsigned int shift = 0;
+
+	*v = 0;
+	while (*p < end && shift < 64) {
+		*v |= (unsigned long long)(**p & 0x7f) << shift;
+		if (!(*(*p)++ & 0x80))
+			return 0;
+		shift += 7;
+	}
+
+	return -EINVAL;
+}
+
+int proto_get_svarint(const unsigned char **p, const unsigned char *end,
+	long long *v)
+{
+	unsigned long long u;
+	int ret;
+
+	ret = proto_get_varint(p, end, &u);
+	*v = (u >> 1) ^ -(long long)(u & 1);
+
+	return ret;
+}
+
+int proto_frame(struct proto_buf *out, unsigned int type,
+	const unsigned char *payload, size_t len)
+{
+	unsigned char hdr[PROTO_HDR_SIZE];
+	int ret;
+
+	if (len + 1 > PROTO_MAX_FRAME)
+		return -EMSGSIZE;
+
+	hdr[0] = (len + 1) & 0xff;
+	hdr[1] = ((len + 1) >> 8) & 0xff;
+	hdr[2] = ((len + 1) >> 16) & 0xff;
+	hdr[3] = ((len + 1) >> 24) & 0xff;
+	hdr[4] = type;
+
+	if (proto_reserve(out, sizeof(hdr) + len) < 0)
+		return -ENOMEM;
+	ret = proto_put_bytes(out, hdr, sizeof(hdr));
+	if (ret == 0)
+		ret = proto_put_bytes(out, payload, len);
+
+	return ret;
+}
+
+/* Returns the size of the first complete frame, 0 if there is none yet */
+int proto_next_frame(const unsigned char *data, size_t len,
+	unsigned int *type, const unsigned char **payload, size_t *plen)
+{
+	size_t flen;
+
+	if (len < PROTO_HDR_SIZE)
+		return 0;
+
+	flen = data[0] | (data[1] << 8) | (data[2] << 16) |
+		((size_t)data[3] << 24);
+	if (flen == 0 || flen > PROTO_MAX_FRAME)
+		return -EINVAL;
+	if (len < flen + 4)
+		return 0;
+
+	*type = data[4];
+	*payload = data + PROTO_HDR_SIZE;
+	*plen = flen - 1;
+
+	return flen + 4;
+}
+
+static size_t queue_frame_len(const struct proto_queue *q, size_t off)
+{
+	const unsigned char *d = q->buf.data + off;
+
+	return 4 + (d[0] | (d[1] << 8) | (d[2] << 16) | ((size_t)d[3] << 24));
+}
+
+int proto_queue_push(struct proto_queue *q, unsigned int type,
+	const unsigned char *payload, size_t len)
+{
+	size_t flen = PROTO_HDR_SIZE + len;
+
+	if (flen > q->max)
+		return -EMSGSIZE;
+
+	/* Make room by dropping whole frames, never the one in flight */
+	while (q->buf.len - q->head + flen > q->max) {
+		size_t off = q->head, skip;
+
+		if (q->sent) {
+			off += queue_frame_len(q, q->head);
+			if (off >= q->buf.len)
+				return -ENOBUFS;
+			skip = queue_frame_len(q, off);
+			memmove(q->buf.data + off, q->buf.data + off + skip,
+				q->buf.len - off - skip);
+			q->buf.len -= skip;
+		} else {
+			q->head += queue_frame_len(q, q->head);
+		}
+		q->dropped++;
+	}
+
+	if (q->head && q->buf.len + flen > q->max) {
+		memmove(q->buf.data, q->buf.data + q->head, q->buf.len - q->head);
+		q->buf.len -= q->head;
+		q->head = 0;
+	}
+
+	return proto_frame(&q->buf, type, payload, len);
+}
+
+/* Sends what the socket takes without blocking, -errno once it is dead */
+int proto_queue_flush(struct proto_queue *q, int fd)
+{
+	ssize_t ret;
+
+	while (q->head < q->buf.len) {
+		ret = send(fd, q->buf.data + q->head + q->sent,
+			q->buf.len - q->head - q->sent,
+			MSG_DONTWAIT | MSG_NOSIGNAL);
+		if (ret < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return 0;
+			return -errno;
+		}
+		q->sent += ret;
+		while (q->head < q->buf.len &&
+		       q->sent >= queue_frame_len(q, q->head)) {
+			q->sent -= queue_frame_len(q, q->head);
+			q->head += queue_frame_len(q, q->head);
+		}
+	}
+
+	q->buf.len = 0;
+	q->head = 0;
+
+	return 0;
+}
+
+void proto_queue_rewind(struct proto_queue *q)
+{
+	q->sent = 0;
+}
+
+static int proto_addrinfo(const char *spec, int passive, struct addrinfo **res)
+{
+	struct addrinfo hints;
+	char host[256], *port;
+	int ret;
+
+	snprintf(host, sizeof(host), "%s", spec);
+	port = strrchr(host, ':');
+	if (port == NULL) {
+		fprintf(stderr, "Invalid endpoint \"%s\", expected host:port\n",
+			spec);
+		return -EINVAL;
+	}
+	*port++ = '\0';
+
+	memset(&hints, 0x00, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = passive ? AI_PASSIVE : 0;
+
+	ret = getaddrinfo(host[0] ? host : NULL, port, &hints, res);
+	if (ret) {
+		fprintf(stderr, "%s: %s\n", spec, gai_strerror(ret));
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+/*
+ * Connects without blocking and waits for the result in poll(), so the
+ * timeout holds whatever the kernel does with the SYN.  It is kept as
+ * the send timeout of the socket.
+ */
+static int connect_timeout(int fd, const struct addrinfo *ai,
+	unsigned int timeout_ms)
+{
+	struct pollfd pfd = { fd, POLLOUT, 0 };
+	socklen_t len = sizeof(int);
+	int flags, err, ret;
+
+	flags = fcntl(fd, F_GETFL);
+	if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0)
+		return -errno;
+
+	ret = connect(fd, ai->ai_addr, ai->ai_addrlen);
+	if (ret < 0 && errno != EINPROGRESS)
+		return -errno;
+
+	if (ret < 0) {
+		do {
+			ret = poll(&pfd, 1, timeout_ms ? (int)timeout_ms : -1);
+		} while (ret < 0 && errno == EINTR);
+		if (ret < 0)
+			return -errno;
+		if (ret == 0)
+			return -ETIMEDOUT;
+		if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0)
+			return -errno;
+		if (err)
+			return -err;
+	}
+
+	if (fcntl(fd, F_SETFL, flags) < 0)
+		return -errno;
+
+	return 0;
+}
+
+/* A timeout of 0 waits for as long as the kernel retries the connect */
+int proto_connect(const char *spec, unsigned int timeout_ms)
+{
+	struct timeval tv = { timeout_ms / 1000, (timeout_ms % 1000) * 1000 };
+	struct addrinfo *res, *ai;
+	int fd = -1, ret;
+
+	ret = proto_addrinfo(spec, 0, &res);
+	if (ret < 0)
+		return ret;
+
+	for (ai = res; ai; ai = ai->ai_next) {
+		fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+		if (fd < 0) {
+			ret = -errno;
+			continue;
+		}
+		setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+		ret = connect_timeout(fd, ai, timeout_ms);
+		if (ret == 0)
+			break;
+		close(fd);
+		fd = -1;
+	}
+	if (fd >= 0)
+		ret = fd;
+	freeaddrinfo(res);
+
+	return ret;
+}
+
+int proto_listen(const char *spec)
+{
+	struct addrinfo *res, *ai;
+	int fd = -1, one = 1, ret;
+
+	ret = proto_addrinfo(spec, 1, &res);
+	if (ret < 0)
+		return ret;
+
+	for (ai = res; ai; ai = ai->ai_next) {
+		fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+		if (fd < 0)
+			continue;
+		setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+		if (bind(fd, ai->ai_addr, ai->ai_addrlen) == 0 &&
+		    listen(fd, SOMAXCONN) == 0)
+			break;
+		close(fd);
+		fd = -1;
+	}
+	ret = fd < 0 ? -errno : fd;
+	freeaddrinfo(res);
+
+	return ret;
+}
+
+int proto_send_all(int fd, const unsigned char *data, size_t len)
+{
+	ssize_t ret;
+
+	while (len) {
+		ret = send(fd, data, len, MSG_NOSIGNAL);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			return -errno;
+		}
+		data += ret;
+		len -= ret;
+	}
+
+	return 0;
+}
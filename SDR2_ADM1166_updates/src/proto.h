@@ -0,0 +1,71 @@
+/*
+ * Copyright (C) 2015-2016 Analog Devices, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * */
+
+#ifndef __PROTO_H__
+#define __PROTO_H__
+
+#include <stddef.h>
+
+/*
+ * Frames are a 4 byte little endian length, a 1 byte type and length - 1
+ * bytes of payload.  Integers inside payloads are LEB128 varints, signed
+ * ones zigzag encoded first.
+ */
+#define PROTO_HDR_SIZE		5
+#define PROTO_MAX_FRAME		(1 << 20)
+
+struct proto_buf {
+	unsigned char *data;
+	size_t len;
+	size_t size;
+};
+
+void proto_buf_free(struct proto_buf *b);
+int proto_put_bytes(struct proto_buf *b, const void *data, size_t len);
+int proto_put_varint(struct proto_buf *b, unsigned long long v);
+int proto_put_svarint(struct proto_buf *b, long long v);
+int proto_get_varint(const unsigned char **p, const unsigned char *end,
+	unsigned long long *v);
+int proto_get_svarint(const unsigned char **p, const unsigned char *end,
+	long long *v);
+
+int proto_frame(struct proto_buf *out, unsigned int type,
+	const unsigned char *payload, size_t len);
+int proto_next_frame(const unsigned char *data, size_t len,
+	unsigned int *type, const unsigned char **payload, size_t *plen);
+
+/*
+ * Bounded outgoing frame queue.  When a new frame does not fit the oldest
+ * whole frames are dropped and counted, a partially sent frame is resent
+ * from its start after a reconnect.
+ */
+struct proto_queue {
+	struct proto_buf buf;
+	size_t head;
+	size_t sent;
+	size_t max;
+	unsigned long long dropped;
+};
+
+int proto_queue_push(struct proto_queue *q, unsigned int type,
+	const unsigned char *payload, size_t len);
+int proto_queue_flush(struct proto_queue *q, int fd);
+void proto_queue_rewind(struct proto_queue *q);
+
+int proto_connect(const char *spec, unsigned int timeout_ms);
+int proto_listen(const char *spec);
+int proto_send_all(int fd, const unsigned char *data, size_t len);
+
+#endif
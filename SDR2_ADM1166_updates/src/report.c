@@ -0,0 +1,489 @@
+/*
+ * Copyright (C) 2015-2016 Analog Devices, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "adm1166.h"
+
+/* Register names as used by the ADM1166.txt export of the Windows tool */
+static const char * const adm1166_reg_names[ADM1166_NUM_REGS] = {
+	[0x00] = "PS10VTH",
+	[0x01] = "PS1OVHYST",
+	[0x02] = "PS1UVTH",
+	[0x03] = "PS1UVHYST",
+	[0x04] = "SFDV1CFG",
+	[0x05] = "SFDV1SEL",
+	[0x07] = "PDO1CFG",
+	[0x08] = "PS2OVTH",
+	[0x09] = "PS2OVHYST",
+	[0x0a] = "PS2UVTH",
+	[0x0b] = "PS2UVHYST",
+	[0x0c] = "SFDV2CFG",
+	[0x0d] = "SFDV2SEL",
+	[0x0f] = "PDO2CFG",
+	[0x10] = "PS3OVTH",
+	[0x11] = "PS3OVHYST",
+	[0x12] = "PS3UVTH",
+	[0x13] = "PS3UVHYST",
+	[0x14] = "SFD3CFG",
+	[0x15] = "SFDV3SEL",
+	[0x17] = "PDO3CFG",
+	[0x18] = "PS4OVTH",
+	[0x19] = "PS4OVHYST",
+	[0x1a] = "PS4UVTH",
+	[0x1b] = "PS4UVHYST",
+	[0x1c] = "SFDV4CFG",
+	[0x1d] = "SFDV4SEL",
+	[0x1f] = "PDO4CFG",
+	[0x20] = "PSVHOVTH",
+	[0x21] = "PSVHOVHYST",
+	[0x22] = "PSVHUVTH",
+	[0x23] = "PSVHUVHYST",
+	[0x24] = "SFDVHCFG",
+	[0x25] = "SFDVHSEL",
+	[0x27] = "PDO5CFG",
+	[0x28] = "X1OVTH",
+	[0x29] = "X1OVHYST",
+	[0x2a] = "X1UVTH",
+	[0x2b] = "X1UVHYST",
+	[0x2c] = "SFDX1CFG",
+	[0x2d] = "SFDVX1SEL",
+	[0x2e] = "GPIX1CFG",
+	[0x2f] = "PDO6CFG",
+	[0x30] = "X2OVTH",
+	[0x31] = "X2OVHYST",
+	[0x32] = "X2UVTH",
+	[0x33] = "X2UVHYST",
+	[0x34] = "SFDX2CFG",
+	[0x35] = "SFDVX2SEL",
+	[0x36] = "GPIX2CFG",
+	[0x37] = "PDO7CFG",
+	[0x38] = "X3OVTH",
+	[0x39] = "X3OVHYST",
+	[0x3a] = "X3UVTH",
+	[0x3b] = "X3UVHYST",
+	[0x3c] = "SFDX3CFG",
+	[0x3d] = "SFDVX3SEL",
+	[0x3e] = "GPIX3CFG",
+	[0x3f] = "PDO8CFG",
+	[0x40] = "X4OVTH",
+	[0x41] = "X4OVHYST",
+	[0x42] = "X4UVTH",
+	[0x43] = "X4UVHYST",
+	[0x44] = "SFDX4CFG",
+	[0x45] = "SFDVX4SEL",
+	[0x46] = "GPIX4CFG",
+	[0x47] = "PDO9CFG",
+	[0x48] = "X5OVTH",
+	[0x49] = "X5OVHYST",
+	[0x4a] = "X5UVTH",
+	[0x4b] = "X5UVHYST",
+	[0x4c] = "SFDX5CFG",
+	[0x4d] = "SFDVX5SEL",
+	[0x4e] = "GPIX5CFG",
+	[0x4f] = "PDO10CFG",
+	[0x50] = "DACCTRL1",
+	[0x51] = "DACCTRL2",
+	[0x52] = "DACCTRL3",
+	[0x53] = "DACCTRL4",
+	[0x54] = "DACCTRL5",
+	[0x55] = "DACCTRL6",
+	[0x58] = "DAC1",
+	[0x59] = "DAC2",
+	[0x5a] = "DAC3",
+	[0x5b] = "DAC4",
+	[0x5c] = "DAC5",
+	[0x5d] = "DAC6",
+	[0x60] = "DPLIM1",
+	[0x61] = "DPLIM2",
+	[0x62] = "DPLIM3",
+	[0x63] = "DPLIM4",
+	[0x64] = "DPLIM5",
+	[0x65] = "DPLIM6",
+	[0x68] = "DNLIM1",
+	[0x69] = "DNLIM2",
+	[0x6a] = "DNLIM3",
+	[0x6b] = "DNLIM4",
+	[0x6c] = "DNLIM5",
+	[0x6d] = "DNLIM6",
+	[0x70] = "ADCVP1LIM",
+	[0x71] = "ADCVP2LIM",
+	[0x72] = "ADCVP3LIM",
+	[0x73] = "ADCVP4LIM",
+	[0x74] = "ADCVHLIM",
+	[0x75] = "ADCVX1LIM",
+	[0x76] = "ADCVX2LIM",
+	[0x77] = "ADCVX3LIM",
+	[0x78] = "ADCVX4LIM",
+	[0x79] = "ADCVX5LIM",
+	[0x7a] = "ADCAUX1LIM",
+	[0x7b] = "ADCAUX2LIM",
+	[0x7c] = "ADCAUX3LIM",
+	[0x7d] = "LSENSE1",
+	[0x7e] = "LSENSE2",
+	[0x7f] = "SMBUSTMO(116X)",
+	[0x80] = "RRSEL1",
+	[0x81] = "RRSEL2",
+	[0x82] = "RRCTRL",
+	[0x83] = "TSCTRL",
+	[0x90] = "UPDCFG",
+	[0x91] = "PDEN1",
+	[0x92] = "PDEN2",
+	[0x93] = "SECTRL",
+	[0x94] = "BBWRTRG1(116X)",
+	[0x95] = "BBWRTRG2(116X)",
+	[0x96] = "BBWRTRG3(116X)",
+	[0x97] = "BBWRTRG4(116X)",
+	[0x98] = "BBWRTRG5(116X)",
+	[0x99] = "BBWRTRG6(116X)",
+	[0x9a] = "BBWRTRG7(116X)",
+	[0x9b] = "BBWRTRG8(116X)",
+	[0x9c] = "BBCTRL(116X)",
+};
+
+static const char * const adm1166_ee_names[] = {
+	"CONFIGURATION EEPROM CHECKSUM LSB",
+	"CONFIGURATION EEPROM CHECKSUM MSB",
+	"USER EEPROM CHECKSUM LSB",
+	"USER EEPROM CHECKSUM MSB",
+	"SE CHECKSUM LSB",
+	"SE CHECKSUM 2ND BYTE",
+	"SE CHECKSUM MSB",
+	"DEVICE ID",
+};
+
+static const char * const adm1166_version_names[] = {
+	"CONFIGURATION VERSION LSB",
+	"CONFIGURATION VERSION 2ND BYTE",
+	"CONFIGURATION VERSION MSB",
+};
+
+/* SFD glitch filter lengths in us, indexed by SFDCFG bits 4:2 */
+static const unsigned int adm1166_glitch_us[8] = {
+	0, 5, 10, 20, 40, 60, 80, 100,
+};
+
+const char *adm1166_reg_name(unsigned int reg)
+{
+	if (reg >= ADM1166_NUM_REGS || adm1166_reg_names[reg] == NULL)
+		return "RESERVED LOCATION";
+	return adm1166_reg_names[reg];
+}
+
+const char *adm1166_eeprom_name(unsigned int addr)
+{
+	unsigned int offset = addr - ADM1166_EEPROM_BASE;
+
+	if (addr < ADM1166_EEPROM_BASE || addr >= ADM1166_USER_BASE)
+		return "";
+	if (addr >= ADM1166_EE_CFG_CSUM && addr <= ADM1166_EE_DEVICE_ID)
+		return adm1166_ee_names[addr - ADM1166_EE_CFG_CSUM];
+	if (addr >= ADM1166_EE_CFG_VERSION && addr < ADM1166_EE_CFG_VERSION + 3)
+		return adm1166_version_names[addr - ADM1166_EE_CFG_VERSION];
+
+	return adm1166_reg_name(offset);
+}
+
+static unsigned int ee_value(const struct adm1166_image *img,
+	unsigned int addr, unsigned int len)
+{
+	unsigned int val = 0;
+
+	while (len--)
+		val = (val << 8) | img->data[addr + len - ADM1166_EEPROM_BASE];
+
+	return val;
+}
+
+static int ee_valid(const struct adm1166_image *img, unsigned int addr)
+{
+	return adm1166_image_valid(img, addr - ADM1166_EEPROM_BASE);
+}
+
+/* Decoded meaning of a configuration byte, empty if there is none */
+static void decode_reg(unsigned int reg, unsigned int val, char *buf,
+	unsigned int len)
+{
+	unsigned int n, ch, pos = 0;
+
+	buf[0] = '\0';
+
+	if (reg < 8 * ADM1166_NUM_SFDS && reg % 8 == 4) {
+		snprintf(buf, len, "glitch=%uus", adm1166_glitch_us[(val >> 2) & 7]);
+	} else if (reg >= ADM1166_REG_DACCTRL(1) &&
+		   reg <= ADM1166_REG_DACCTRL(ADM1166_NUM_DACS)) {
+		snprintf(buf, len, "%s", val & ADM1166_DACCTRL_ENABLE ?
+			"enabled" : "disabled");
+	} else if (reg >= ADM1166_REG_DAC(1) &&
+		   reg <= ADM1166_REG_DAC(ADM1166_NUM_DACS)) {
+		snprintf(buf, len, "offset=%+d", (int)val - ADM1166_DAC_MIDCODE);
+	} else if (reg == ADM1166_REG_RRSEL1 || reg == ADM1166_REG_RRSEL2) {
+		/* Deselect masks, RRSEL1 covers VP1 - VX3, RRSEL2 the rest */
+		n = reg == ADM1166_REG_RRSEL1 ? 0 : 8;
+		pos = snprintf(buf, len, "%s", val ? "off=" : "all enabled");
+		for (ch = n; ch < n + 8 && ch < ADM1166_ADC_CHANNELS; ch++) {
+			if (!(val & (1 << (ch - n))) || pos >= len)
+				continue;
+			pos += snprintf(buf + pos, len - pos, "%s%s",
+				buf[pos - 1] == '=' ? "" : ",",
+				adm1166_adc_channel_name(ch));
+		}
+	} else if (reg == ADM1166_REG_RRCTRL) {
+		snprintf(buf, len, "%s%s%s%s",
+			val & 0x01 ? "go " : "", val & 0x02 ? "avg " : "",
+			val & 0x04 ? "enable " : "", val & 0x08 ? "stopwrite " : "");
+		n = strlen(buf);
+		if (n)
+			buf[n - 1] = '\0';
+	} else if (reg == ADM1166_REG_TSCTRL) {
+		snprintf(buf, len, "%s", val & ADM1166_TSCTRL_ENABLE ?
+			"enabled" : "disabled");
+	} else if (reg == ADM1166_REG_UPDCFG) {
+		if (val & ADM1166_UPDCFG_EEPROM_EN)
+			snprintf(buf, len, "eeprom_en");
+	} else if (reg == ADM1166_REG_SECTRL) {
+		if (val & ADM1166_SECTRL_HALT)
+			snprintf(buf, len, "halt");
+	}
+}
+
+static void print_line(FILE *f, const char *prefix, int valid,
+	unsigned int val, const char *name, const char *decoded)
+{
+	if (valid)
+		fprintf(f, "\t<%s;%02X> %s", prefix, val, name);
+	else
+		fprintf(f, "\t<%s;--> %s", prefix, name);
+	if (decoded && decoded[0])
+		fprintf(f, "\t%s", decoded);
+	fprintf(f, "\n");
+}
+
+static void print_title(FILE *f, const char *title)
+{
+	unsigned int i, len = strlen(title);
+
+	fprintf(f, "\t%s\n        ", title);
+	for (i = 0; i < len; i++)
+		fputc('-', f);
+	fprintf(f, "\t\n\t\n");
+}
+
+/* All states count as reachable unless the image has the whole table */
+static unsigned long long se_reach(const struct adm1166_image *img)
+{
+	unsigned int addr;
+
+	for (addr = ADM1166_SE_BASE; addr < ADM1166_EEPROM_BASE +
+	     ADM1166_EEPROM_SIZE; addr++) {
+		if (!ee_valid(img, addr))
+			return ~0ULL;
+	}
+
+	return adm1166_se_reachable(img->data + ADM1166_SE_BASE -
+		ADM1166_EEPROM_BASE);
+}
+
+static void print_states(FILE *f, unsigned long long states)
+{
+	unsigned int i, j;
+
+	for (i = 0; i < ADM1166_SE_STATES; i = j + 1) {
+		for (j = i; j < ADM1166_SE_STATES && (states & (1ULL << j)); j++)
+			;
+		if (j > i + 1)
+			fprintf(f, " %u-%u", i, j - 1);
+		else if (j > i)
+			fprintf(f, " %u", i);
+	}
+}
+
+static void print_reach(FILE *f, unsigned long long reach)
+{
+	unsigned long long reserved = 0;
+	unsigned int i;
+
+	fprintf(f, "\tReachable States:");
+	print_states(f, reach);
+	fprintf(f, "\n");
+
+	for (i = 0; i < ADM1166_SE_STATES; i++) {
+		if (adm1166_page_reserved(ADM1166_SE_BASE + 8 * i))
+			reserved |= 1ULL << i;
+	}
+	if (!(reach & reserved))
+		return;
+	fprintf(f, "\tWarning: reachable states");
+	print_states(f, reach & reserved);
+	fprintf(f, " lie in reserved pages and are never programmed\n");
+}
+
+/*
+ * Renders a configuration in the layout of the ADM1166.txt export: the
+ * registers (taken from the EEPROM mirror when regs is NULL), the
+ * configuration and user EEPROM and the sequence engine states.  The
+ * checksums are the ones stored in the EEPROM.  States without an entry
+ * in names are called State<n>.  Unless flags has
+ * ADM1166_REPORT_PLAIN set, decoded fields follow the names after a tab
+ * and states the engine cannot reach from state 0 are marked.
+ */
+void adm1166_report(FILE *f, const char *source,
+	const struct adm1166_image *img, const unsigned char *regs,
+	char * const *names, unsigned int flags)
+{
+	int decode = !(flags & ADM1166_REPORT_PLAIN);
+	unsigned long long reach = se_reach(img);
+	struct adm1166_se_state st;
+	unsigned int addr, i, val;
+	char prefix[8], buf[64];
+
+	fprintf(f, "Device: ADM1166\n\n");
+	if (source)
+		fprintf(f, "Source: %s\n\n", source);
+	fprintf(f, "Configuration Version: %04X - %02X\n\n\n",
+		ee_value(img, ADM1166_EE_CFG_VERSION + 1, 2),
+		ee_value(img, ADM1166_EE_CFG_VERSION, 1));
+
+	print_title(f, "Configuration Register Locations");
+	for (i = 0; i < ADM1166_NUM_REGS; i++) {
+		addr = ADM1166_EEPROM_BASE + i;
+		val = regs ? regs[i] : img->data[i];
+		/* Checksums and device ID are only mirrored in the EEPROM */
+		if (!regs && addr >= ADM1166_EE_CFG_CSUM &&
+		    addr <= ADM1166_EE_DEVICE_ID)
+			val = 0;
+		if (decode)
+			decode_reg(i, val, buf, sizeof(buf));
+		snprintf(prefix, sizeof(prefix), "%02X", i);
+		print_line(f, prefix, regs || ee_valid(img, addr), val,
+			adm1166_reg_name(i), decode ? buf : NULL);
+	}
+	fprintf(f, "\t\n\tConfigurable Locations Checksum = %04Xh\t\n\t\n\t\n\t\n",
+		ee_value(img, ADM1166_EE_CFG_CSUM, 2));
+
+	print_title(f, "Configuration EEPROM Locations");
+	for (addr = ADM1166_EEPROM_BASE; addr < ADM1166_USER_BASE; addr++) {
+		val = img->data[addr - ADM1166_EEPROM_BASE];
+		buf[0] = '\0';
+		if (decode && addr - ADM1166_EEPROM_BASE < ADM1166_NUM_REGS)
+			decode_reg(addr - ADM1166_EEPROM_BASE, val, buf, sizeof(buf));
+		if (decode && addr == ADM1166_EE_CFG_CSUM)
+			snprintf(buf, sizeof(buf), "%04Xh", ee_value(img, addr, 2));
+		else if (decode && addr == ADM1166_EE_USER_CSUM)
+			snprintf(buf, sizeof(buf), "%04Xh", ee_value(img, addr, 2));
+		else if (decode && addr == ADM1166_EE_SE_CSUM)
+			snprintf(buf, sizeof(buf), "%05Xh", ee_value(img, addr, 3));
+		snprintf(prefix, sizeof(prefix), "%02X;%02X", addr >> 8, addr & 0xff);
+		print_line(f, prefix, ee_valid(img, addr), val,
+			adm1166_eeprom_name(addr), buf);
+	}
+	fprintf(f, "\t\n\tConfigurable EEPROM Locations Checksum = %04Xh\t\n"
+		"\t\n\t\n\t\n", ee_value(img, ADM1166_EE_CFG_CSUM, 2));
+
+	print_title(f, "User EEPROM Locations");
+	for (addr = ADM1166_USER_BASE; addr < ADM1166_SE_BASE; addr++) {
+		snprintf(prefix, sizeof(prefix), "%02X;%02X", addr >> 8, addr & 0xff);
+		print_line(f, prefix, ee_valid(img, addr),
+			img->data[addr - ADM1166_EEPROM_BASE], "USER EEPROM", NULL);
+	}
+	fprintf(f, "\t\n\tUser EEPROM Locations Checksum = %04Xh\t\n\t\n\t\n\t\n",
+		ee_value(img, ADM1166_EE_USER_CSUM, 2));
+
+	fprintf(f, "\tSequence Engine EEPROM Locations\n"
+		"        -------------------------------------\t\n\t\n");
+	for (i = 0; i < ADM1166_SE_STATES; i++) {
+		if (i == 0)
+			fprintf(f, "\tRESERVED STATE\n");
+		else if (names && names[i])
+			fprintf(f, "\tSTART OF %s\n", names[i]);
+		else
+			fprintf(f, "\tSTART OF State%u\n", i);
+		for (addr = ADM1166_SE_BASE + 8 * i;
+		     addr < ADM1166_SE_BASE + 8 * (i + 1); addr++) {
+			snprintf(prefix, sizeof(prefix), "%02X;%02X", addr >> 8,
+				addr & 0xff);
+			print_line(f, prefix, ee_valid(img, addr),
+				img->data[addr - ADM1166_EEPROM_BASE], "", NULL);
+		}
+		if (decode) {
+			adm1166_se_decode(img->data + ADM1166_SE_BASE -
+				ADM1166_EEPROM_BASE + 8 * i, &st);
+			fprintf(f, "\tpdo=%03x monitor=%03x seq=%u timer=%u "
+				"next_seq=%u next_timeout=%u next_monitor=%u%s\n",
+				st.pdo, st.monitor_mask, st.seq_sel, st.timer,
+				st.next_seq, st.next_timeout, st.next_monitor,
+				reach & (1ULL << i) ? "" : " unreachable");
+		}
+		fprintf(f, "\t\t\n");
+	}
+	fprintf(f, "\tSequencing Engine Checksum = %Xh\t\n",
+		ee_value(img, ADM1166_EE_SE_CSUM, 3));
+	if (decode && reach != ~0ULL)
+		print_reach(f, reach);
+}
+
+/* Bits of a register that change on their own at runtime */
+static unsigned int drift_volatile(unsigned int reg)
+{
+	if (reg == ADM1166_REG_RRCTRL)
+		return 0x01;
+	return 0;
+}
+
+/*
+ * Registers that differ from the value they get at power-up, the EEPROM
+ * copy except for UPDCFG and SECTRL which come up cleared.  Reserved
+ * locations and the checksum mirror are not compared, nor are the bits
+ * set in ignore (per register, may be NULL).
+ */
+unsigned int adm1166_drift(const unsigned char *live, const unsigned char *ee,
+	const unsigned char *ignore, struct adm1166_drift *d)
+{
+	unsigned int reg, mask, val, n = 0;
+
+	for (reg = 0; reg < ADM1166_NUM_REGS; reg++) {
+		if (adm1166_reg_names[reg] == NULL ||
+		    (reg >= ADM1166_EE_CFG_CSUM - ADM1166_EEPROM_BASE &&
+		     reg <= ADM1166_EE_DEVICE_ID - ADM1166_EEPROM_BASE))
+			continue;
+		val = reg == ADM1166_REG_UPDCFG || reg == ADM1166_REG_SECTRL ?
+			0 : ee[reg];
+		mask = ~drift_volatile(reg) & ~(ignore ? ignore[reg] : 0) & 0xff;
+		if ((live[reg] & mask) == (val & mask))
+			continue;
+		d[n].reg = reg;
+		d[n].ee = val;
+		d[n].live = live[reg];
+		n++;
+	}
+
+	return n;
+}
+
+void adm1166_drift_print(FILE *f, const char *prefix,
+	const struct adm1166_drift *d)
+{
+	char from[64], to[64];
+
+	decode_reg(d->reg, d->ee, from, sizeof(from));
+	decode_reg(d->reg, d->live, to, sizeof(to));
+
+	fprintf(f, "%s%02X %-16s %02X -> %02X", prefix, d->reg,
+		adm1166_reg_name(d->reg), d->ee, d->live);
+	if (from[0] || to[0])
+		fprintf(f, "\t%s -> %s", from[0] ? from : "-", to[0] ? to : "-");
+	fprintf(f, "\n");
+}
@@ -0,0 +1,704 @@
+/*
+ * Copyright (C) 2015-2016 Analog Devices, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * */
+
+/*
+ * Simulated ADM1166 behind the same message interface as /dev/i2c-N.
+ *
+ * The model is deliberately simple: every rail sits in the middle of its
+ * supply fault detector window, the margining DACs shift their coupled
+ * channel by one threshold LSB per DAC code, and the sequence engine runs
+ * the state table from the loaded image with one timer count per ms.
+ * Thresholds are compared against the top 8 bits of the ADC code.
+ */
+
+#include <errno.h>
+#include <linux/i2c.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "adm1166.h"
+
+#define SIM_TIMER_UNIT_NS	1000000ULL
+#define SIM_SE_RESPONSE_NS	10000ULL
+#define SIM_DAC_GAIN		16
+/* Rail drift in 12 bit codes per C, relative to 25 C */
+#define SIM_TEMPCO		1
+
+#define CMD_BLOCK_WRITE		0xfc
+#define CMD_BLOCK_READ		0xfd
+#define CMD_ERASE		0xfe
+
+/*
+ * Devices attached to one virtual bus take turns: every transaction holds
+ * the bus for its time on the wire, the host overhead follows outside.
+ */
+struct adm1166_sim_bus {
+	pthread_mutex_t lock;
+	struct adm1166_bus_model model;
+};
+
+struct adm1166_sim {
+	unsigned char eeprom[ADM1166_EEPROM_SIZE];
+	unsigned char regs[256];
+	unsigned int ptr;
+	int dac_channel[ADM1166_NUM_DACS];
+	unsigned int adc_latch[ADM1166_ADC_CHANNELS];
+	unsigned long long adc_round[ADM1166_ADC_CHANNELS];
+	unsigned int state;
+	unsigned long long entered_ns;
+	unsigned long long fault_ns;
+	unsigned int seed;
+	int temp_mc;
+	struct adm1166_bus_stats stats;
+	struct adm1166_sim_bus *bus;
+};
+
+/*
+ * I2C timing in ns per speed mode: hold after START, setup of a repeated
+ * START, setup of STOP and bus free time between STOP and START.
+ */
+static const struct {
+	unsigned int max_hz;
+	unsigned int hd_sta;
+	unsigned int su_sta;
+	unsigned int su_sto;
+	unsigned int buf;
+} sim_i2c_timing[] = {
+	{ 100000, 4000, 4700, 4000, 4700 },
+	{ 400000, 600, 600, 600, 1300 },
+	{ 1000000, 260, 260, 260, 500 },
+};
+
+/* SFD glitch filter lengths in us, indexed by SFDCFG bits 4:2 */
+static const unsigned int sim_glitch_us[8] = {
+	0, 5, 10, 20, 40, 60, 80, 100,
+};
+
+static unsigned long long sim_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static const struct adm1166_ops adm1166_sim_ops;
+
+static struct adm1166_sim *to_sim(struct adm1166 *dev)
+{
+	if (dev->ops != &adm1166_sim_ops)
+		return NULL;
+	return dev->priv;
+}
+
+static void sim_se_state(struct adm1166_sim *sim, unsigned int n,
+	struct adm1166_se_state *st)
+{
+	adm1166_se_decode(sim->eeprom + ADM1166_SE_BASE - ADM1166_EEPROM_BASE +
+		8 * n, st);
+}
+
+static void sim_enter(struct adm1166_sim *sim, unsigned int n,
+	unsigned long long t)
+{
+	sim->state = n;
+	sim->entered_ns = t;
+	sim->fault_ns = 0;
+}
+
+/* Nominal 8 bit level of a channel, centered in its SFD window */
+static unsigned int sim_nominal(struct adm1166_sim *sim, unsigned int ch)
+{
+	unsigned int ov, uv;
+
+	if (ch >= ADM1166_NUM_SFDS)
+		return 0x80;
+
+	ov = sim->regs[ADM1166_REG_OVTH(ch)];
+	uv = sim->regs[ADM1166_REG_UVTH(ch)];
+
+	if (ov && uv)
+		return (ov + uv) / 2;
+	if (ov)
+		return ov - ov / 8;
+	if (uv)
+		return uv + 8;
+	return 0x80;
+}
+
+static int sim_level(struct adm1166_sim *sim, unsigned int ch)
+{
+	int code = sim_nominal(sim, ch) << 4;
+	unsigned int i;
+
+	if (ch == ADM1166_ADC_TEMP) {
+		if (!(sim->regs[ADM1166_REG_TSCTRL] & ADM1166_TSCTRL_ENABLE))
+			return 0;
+		return ADM1166_TEMP_ZERO_CODE + sim->temp_mc / ADM1166_TEMP_LSB_MC;
+	}
+	if (ch < ADM1166_NUM_SFDS)
+		code += (sim->temp_mc - 25000) * SIM_TEMPCO / 1000;
+
+	for (i = 0; i < ADM1166_NUM_DACS; i++) {
+		if (sim->dac_channel[i] != (int)ch ||
+		    !(sim->regs[ADM1166_REG_DACCTRL(i + 1)] & ADM1166_DACCTRL_ENABLE))
+			continue;
+		code += ((int)sim->regs[ADM1166_REG_DAC(i + 1)] -
+			ADM1166_DAC_MIDCODE) * SIM_DAC_GAIN;
+	}
+
+	if (code < 0)
+		code = 0;
+	if (code > 0xfff)
+		code = 0xfff;
+
+	return code;
+}
+
+static unsigned int sim_faults(struct adm1166_sim *sim)
+{
+	unsigned int faults = 0;
+	unsigned int i, ov, uv, level;
+
+	for (i = 0; i < ADM1166_NUM_SFDS; i++) {
+		ov = sim->regs[ADM1166_REG_OVTH(i)];
+		uv = sim->regs[ADM1166_REG_UVTH(i)];
+		level = sim_level(sim, i) >> 4;
+		if ((ov && level > ov) || (uv && level < uv))
+			faults |= 1 << i;
+	}
+
+	return faults;
+}
+
+static unsigned long long sim_fault_delay(struct adm1166_sim *sim,
+	unsigned int faults)
+{
+	unsigned int sfd = 0;
+	unsigned int cfg;
+
+	while (!(faults & (1 << sfd)))
+		sfd++;
+
+	cfg = sim->regs[ADM1166_REG_SFDCFG(sfd)];
+
+	return sim_glitch_us[(cfg >> 2) & 7] * 1000ULL + SIM_SE_RESPONSE_NS +
+		rand_r(&sim->seed) % 8000;
+}
+
+static void sim_update(struct adm1166_sim *sim, unsigned long long now)
+{
+	struct adm1166_se_state st;
+	unsigned long long deadline;
+	unsigned int steps, faults;
+
+	if (sim->regs[ADM1166_REG_SECTRL] & ADM1166_SECTRL_HALT)
+		return;
+
+	for (steps = 0; steps < ADM1166_SE_STATES; steps++) {
+		sim_se_state(sim, sim->state, &st);
+
+		faults = sim_faults(sim);
+
+		if (sim->fault_ns) {
+			/* Glitches shorter than the filter are ignored */
+			if (!(faults & st.monitor_mask))
+				sim->fault_ns = 0;
+			else if (now < sim->fault_ns)
+				break;
+			else
+				sim_enter(sim, st.next_monitor, sim->fault_ns);
+			continue;
+		}
+
+		if (faults & st.monitor_mask) {
+			sim->fault_ns = now + sim_fault_delay(sim,
+				faults & st.monitor_mask);
+			continue;
+		}
+
+		if (st.seq_sel && !faults) {
+			sim_enter(sim, st.next_seq, sim->entered_ns);
+			continue;
+		}
+
+		deadline = sim->entered_ns + st.timer * SIM_TIMER_UNIT_NS;
+		if (st.timer && now >= deadline) {
+			sim_enter(sim, st.next_timeout, deadline);
+			continue;
+		}
+
+		break;
+	}
+}
+
+static void sim_reset(struct adm1166_sim *sim)
+{
+	memset(sim->regs, 0x00, sizeof(sim->regs));
+	memcpy(sim->regs, sim->eeprom, ADM1166_NUM_REGS);
+	/* The checksums and device ID only live in the EEPROM */
+	memset(sim->regs + ADM1166_EE_CFG_CSUM - ADM1166_EEPROM_BASE, 0x00,
+		ADM1166_EE_DEVICE_ID - ADM1166_EE_CFG_CSUM + 1);
+	sim->regs[ADM1166_REG_UPDCFG] = 0;
+	sim->regs[ADM1166_REG_SECTRL] = 0;
+	sim->ptr = 0;
+	sim_enter(sim, 0, sim_now_ns());
+}
+
+/*
+ * Without RRCTRL ENABLE every read sees a fresh conversion.  With it the
+ * round robin only refreshes selected channels, once per cycle, and the
+ * 16x average takes the noise down by 4.  Returns 1 with the noise in
+ * *noise when the channel has a new code.
+ */
+static int sim_adc_convert(struct adm1166_sim *sim, unsigned int ch,
+	int *noise)
+{
+	unsigned int rrctrl = sim->regs[ADM1166_REG_RRCTRL];
+	unsigned int mask, i, n;
+	unsigned long long round;
+	int sum = 0;
+
+	if (!(rrctrl & ADM1166_RRCTRL_ENABLE)) {
+		*noise = (int)(rand_r(&sim->seed) % 5) - 2;
+		return 1;
+	}
+
+	mask = ~(sim->regs[ADM1166_REG_RRSEL1] |
+		 (sim->regs[ADM1166_REG_RRSEL2] << 8)) &
+		((1 << ADM1166_ADC_CHANNELS) - 1);
+	if (!(mask & (1 << ch)) || (rrctrl & ADM1166_RRCTRL_STOPWRITE))
+		return 0;
+
+	round = sim_now_ns() /
+		(adm1166_readback_cycle_us(mask, rrctrl & ADM1166_RRCTRL_AVG) *
+		 1000ULL);
+	if (round == sim->adc_round[ch])
+		return 0;
+	sim->adc_round[ch] = round;
+
+	n = rrctrl & ADM1166_RRCTRL_AVG ? ADM1166_RR_AVG : 1;
+	for (i = 0; i < n; i++)
+		sum += (int)(rand_r(&sim->seed) % 5) - 2;
+	/* Rounded mean, kept non-negative for the division */
+	*noise = (sum + 2 * (int)n + (int)n / 2) / (int)n - 2;
+
+	return 1;
+}
+
+static unsigned int sim_read_byte(struct adm1166_sim *sim)
+{
+	struct adm1166_se_state st;
+	unsigned int addr = sim->ptr;
+	unsigned int ch, pdo;
+	int code;
+
+	sim->ptr = (sim->ptr + 1) & 0xffff;
+
+	if (addr >= ADM1166_EEPROM_BASE) {
+		if (addr >= ADM1166_EEPROM_BASE + ADM1166_EEPROM_SIZE)
+			return 0xff;
+		return sim->eeprom[addr - ADM1166_EEPROM_BASE];
+	}
+	if (addr > 0xff)
+		return 0xff;
+
+	if (addr >= ADM1166_REG_ADC(0) &&
+	    addr < ADM1166_REG_ADC(ADM1166_ADC_CHANNELS)) {
+		ch = (addr - ADM1166_REG_ADC(0)) / 2;
+		if ((addr & 1) == 0 && sim_adc_convert(sim, ch, &code)) {
+			code += sim_level(sim, ch);
+			sim->adc_latch[ch] = code < 0 ? 0 : code > 0xfff ? 0xfff : code;
+		}
+		if ((addr & 1) == 0)
+			return (sim->adc_latch[ch] >> 4) & 0xff;
+		return sim->adc_latch[ch] & 0x0f;
+	}
+
+	switch (addr) {
+	case ADM1166_REG_PDOSTAT1:
+	case ADM1166_REG_PDOSTAT2:
+		sim_se_state(sim, sim->state, &st);
+		pdo = sim->state ? st.pdo : 0;
+		return addr == ADM1166_REG_PDOSTAT1 ? pdo & 0xff : pdo >> 8;
+	case ADM1166_REG_SESTATE:
+		return sim->state;
+	default:
+		return sim->regs[addr];
+	}
+}
+
+static void sim_write_reg(struct adm1166_sim *sim, unsigned int reg,
+	unsigned char val)
+{
+	unsigned int n;
+
+	if (reg >= ADM1166_REG_DAC(1) && reg <= ADM1166_REG_DAC(ADM1166_NUM_DACS)) {
+		n = reg - ADM1166_REG_DAC(1) + 1;
+		if (sim->regs[ADM1166_REG_DPLIM(n)] >= sim->regs[ADM1166_REG_DNLIM(n)]) {
+			if (val > sim->regs[ADM1166_REG_DPLIM(n)])
+				val = sim->regs[ADM1166_REG_DPLIM(n)];
+			if (val < sim->regs[ADM1166_REG_DNLIM(n)])
+				val = sim->regs[ADM1166_REG_DNLIM(n)];
+		}
+	}
+
+	if (reg == ADM1166_REG_SECTRL && (sim->regs[reg] & ADM1166_SECTRL_HALT) &&
+	    !(val & ADM1166_SECTRL_HALT))
+		sim->entered_ns = sim_now_ns();
+
+	sim->regs[reg] = val;
+}
+
+static int sim_eeprom_writable(struct adm1166_sim *sim)
+{
+	return (sim->regs[ADM1166_REG_UPDCFG] & ADM1166_UPDCFG_EEPROM_EN) &&
+		sim->ptr >= ADM1166_EEPROM_BASE &&
+		sim->ptr < ADM1166_EEPROM_BASE + ADM1166_EEPROM_SIZE;
+}
+
+static int sim_write(struct adm1166_sim *sim, const unsigned char *buf,
+	unsigned int len)
+{
+	unsigned int i, offset;
+
+	if (len == 0)
+		return 0;
+
+	switch (buf[0]) {
+	case CMD_BLOCK_WRITE:
+		if (len < 2 || buf[1] != len - 2)
+			return -EIO;
+		if (sim->ptr < ADM1166_EEPROM_BASE) {
+			for (i = 0; i < buf[1]; i++)
+				sim_write_reg(sim, (sim->ptr + i) & 0xff, buf[2 + i]);
+			return 0;
+		}
+		if (!sim_eeprom_writable(sim))
+			return -EIO;
+		offset = sim->ptr - ADM1166_EEPROM_BASE;
+		/* Programming only clears bits, pages have to be erased first */
+		for (i = 0; i < buf[1] && offset + i < ADM1166_EEPROM_SIZE; i++)
+			sim->eeprom[offset + i] &= buf[2 + i];
+		return 0;
+	case CMD_BLOCK_READ:
+		return 0;
+	case ADM1166_CMD_DOWNLOAD:
+		/* Same as power-up: registers from the EEPROM, SE from state 0 */
+		sim_reset(sim);
+		return 0;
+	case CMD_ERASE:
+		if (!sim_eeprom_writable(sim))
+			return -EIO;
+		offset = (sim->ptr - ADM1166_EEPROM_BASE) & ~(ADM1166_PAGE_SIZE - 1);
+		memset(sim->eeprom + offset, 0xff, ADM1166_PAGE_SIZE);
+		return 0;
+	}
+
+	if (buf[0] >= ADM1166_EEPROM_BASE >> 8) {
+		if (len < 2)
+			return -EIO;
+		sim->ptr = (buf[0] << 8) | buf[1];
+		return 0;
+	}
+
+	sim->ptr = buf[0];
+	for (i = 1; i < len; i++)
+		sim_write_reg(sim, (buf[0] + i - 1) & 0xff, buf[i]);
+
+	return 0;
+}
+
+/* Splits every message into command overhead and payload bytes */
+static void sim_account(struct adm1166_sim *sim, const struct i2c_msg *msgs,
+	unsigned int nmsgs)
+{
+	struct adm1166_bus_stats *st = &sim->stats;
+	unsigned int i, cmd;
+
+	st->xfers++;
+	st->msgs += nmsgs;
+
+	for (i = 0; i < nmsgs; i++) {
+		if (msgs[i].len == 0)
+			continue;
+		if (msgs[i].flags & I2C_M_RD) {
+			st->reads++;
+			/* The block read count byte */
+			cmd = i > 0 && msgs[i - 1].len == 1 &&
+				msgs[i - 1].buf[0] == CMD_BLOCK_READ;
+		} else if (msgs[i].buf[0] == CMD_BLOCK_WRITE) {
+			cmd = 2;
+			if (sim->ptr >= ADM1166_EEPROM_BASE)
+				st->writes++;
+		} else if (msgs[i].buf[0] == CMD_ERASE) {
+			cmd = 1;
+			st->erases++;
+		} else if (msgs[i].buf[0] >= ADM1166_EEPROM_BASE >> 8) {
+			cmd = 2;
+		} else {
+			cmd = 1;
+		}
+		if (cmd > msgs[i].len)
+			cmd = msgs[i].len;
+		st->cmd_bytes += cmd;
+		st->data_bytes += msgs[i].len - cmd;
+	}
+}
+
+static int sim_xfer(struct adm1166_sim *sim, struct i2c_msg *msgs,
+	unsigned int nmsgs)
+{
+	int block_read = 0;
+	unsigned int i, j;
+	int ret;
+
+	sim_update(sim, sim_now_ns());
+	sim_account(sim, msgs, nmsgs);
+
+	for (i = 0; i < nmsgs; i++) {
+		if (msgs[i].flags & I2C_M_RD) {
+			j = 0;
+			if (block_read && msgs[i].len > 0)
+				msgs[i].buf[j++] = ADM1166_PAGE_SIZE;
+			for (; j < msgs[i].len; j++)
+				msgs[i].buf[j] = sim_read_byte(sim);
+			block_read = 0;
+		} else {
+			ret = sim_write(sim, msgs[i].buf, msgs[i].len);
+			if (ret < 0)
+				return ret;
+			block_read = msgs[i].len == 1 && msgs[i].buf[0] == CMD_BLOCK_READ;
+		}
+	}
+
+	sim_update(sim, sim_now_ns());
+
+	return 0;
+}
+
+static void sim_sleep_ns(unsigned long long ns)
+{
+	struct timespec ts = { ns / 1000000000ULL, ns % 1000000000ULL };
+
+	while (nanosleep(&ts, &ts) < 0 && errno == EINTR)
+		;
+}
+
+static int adm1166_sim_xfer(struct adm1166 *dev, struct i2c_msg *msgs,
+	unsigned int nmsgs)
+{
+	struct adm1166_sim *sim = dev->priv;
+	struct adm1166_sim_bus *bus = sim->bus;
+	struct adm1166_bus_stats st = sim->stats;
+	int ret;
+
+	if (bus == NULL)
+		return sim_xfer(sim, msgs, nmsgs);
+
+	pthread_mutex_lock(&bus->lock);
+	ret = sim_xfer(sim, msgs, nmsgs);
+	st.xfers = sim->stats.xfers - st.xfers;
+	st.msgs = sim->stats.msgs - st.msgs;
+	st.reads = sim->stats.reads - st.reads;
+	st.cmd_bytes = sim->stats.cmd_bytes - st.cmd_bytes;
+	st.data_bytes = sim->stats.data_bytes - st.data_bytes;
+	sim_sleep_ns(adm1166_bus_time_ns(&st, &bus->model));
+	pthread_mutex_unlock(&bus->lock);
+
+	sim_sleep_ns(st.xfers * (unsigned long long)bus->model.host_ns);
+
+	return ret;
+}
+
+static void adm1166_sim_close(struct adm1166 *dev)
+{
+	free(dev->priv);
+	dev->priv = NULL;
+}
+
+static const struct adm1166_ops adm1166_sim_ops = {
+	.xfer = adm1166_sim_xfer,
+	.close = adm1166_sim_close,
+};
+
+int adm1166_sim_open(struct adm1166 *dev, const char *image)
+{
+	struct adm1166_image img;
+	struct adm1166_sim *sim;
+	unsigned int i;
+	int ret;
+
+	sim = calloc(1, sizeof(*sim));
+	if (sim == NULL)
+		return -ENOMEM;
+
+	if (image) {
+		ret = adm1166_image_load(&img, image);
+		if (ret < 0) {
+			free(sim);
+			return ret;
+		}
+		memcpy(sim->eeprom, img.data, sizeof(sim->eeprom));
+	}
+
+	for (i = 0; i < ADM1166_NUM_DACS; i++)
+		sim->dac_channel[i] = -1;
+	sim->seed = 1;
+	sim->temp_mc = 25000;
+
+	dev->ops = &adm1166_sim_ops;
+	dev->priv = sim;
+	dev->lock = NULL;
+	dev->fd = -1;
+	dev->bus = 0;
+	dev->addr = ADM1166_DEFAULT_ADDR;
+
+	sim_reset(sim);
+
+	return 0;
+}
+
+int adm1166_sim_couple(struct adm1166 *dev, unsigned int dac,
+	unsigned int ch)
+{
+	struct adm1166_sim *sim = to_sim(dev);
+
+	if (sim == NULL)
+		return -ENODEV;
+	if (dac < 1 || dac > ADM1166_NUM_DACS || ch >= ADM1166_ADC_CHANNELS)
+		return -EINVAL;
+
+	sim->dac_channel[dac - 1] = ch;
+
+	return 0;
+}
+
+int adm1166_sim_power_cycle(struct adm1166 *dev)
+{
+	struct adm1166_sim *sim = to_sim(dev);
+
+	if (sim == NULL)
+		return -ENODEV;
+
+	sim_reset(sim);
+
+	return 0;
+}
+
+int adm1166_sim_set_temp(struct adm1166 *dev, int temp_mc)
+{
+	struct adm1166_sim *sim = to_sim(dev);
+
+	if (sim == NULL)
+		return -ENODEV;
+
+	sim->temp_mc = temp_mc;
+
+	return 0;
+}
+
+int adm1166_sim_bus_stats(struct adm1166 *dev, struct adm1166_bus_stats *stats,
+	int reset)
+{
+	struct adm1166_sim *sim = to_sim(dev);
+
+	if (sim == NULL)
+		return -ENODEV;
+
+	if (stats)
+		*stats = sim->stats;
+	if (reset)
+		memset(&sim->stats, 0x00, sizeof(sim->stats));
+
+	return 0;
+}
+
+/*
+ * Time on the wire: 9 clocks per byte (8 bits and the ACK) for the address
+ * of every message and all bytes, START/STOP and bus free time for every
+ * transaction, a repeated START between messages and the clock stretching
+ * of every read.  Each mux level costs a one byte write transaction.
+ */
+unsigned long long adm1166_bus_time_ns(const struct adm1166_bus_stats *stats,
+	const struct adm1166_bus_model *model)
+{
+	unsigned long long bits, ns, frame;
+	unsigned int i = 0;
+
+	while (i < 2 && model->clock_hz > sim_i2c_timing[i].max_hz)
+		i++;
+
+	frame = sim_i2c_timing[i].hd_sta + sim_i2c_timing[i].su_sto +
+		sim_i2c_timing[i].buf;
+
+	bits = 9 * (stats->msgs + stats->cmd_bytes + stats->data_bytes);
+	ns = bits * 1000000000ULL / model->clock_hz;
+	ns += stats->xfers * frame;
+	ns += (stats->msgs - stats->xfers) *
+		(sim_i2c_timing[i].su_sta + sim_i2c_timing[i].hd_sta);
+	ns += stats->reads * model->stretch_ns;
+	ns += stats->xfers * model->mux_levels *
+		(18 * 1000000000ULL / model->clock_hz + frame);
+
+	return ns;
+}
+
+/* Bus time plus the host overhead and the EEPROM cycles */
+unsigned long long adm1166_wall_time_ns(const struct adm1166_bus_stats *stats,
+	const struct adm1166_bus_model *model)
+{
+	return adm1166_bus_time_ns(stats, model) +
+		stats->xfers * (unsigned long long)model->host_ns +
+		stats->erases * (unsigned long long)model->erase_ns +
+		stats->writes * (unsigned long long)model->write_ns;
+}
+
+struct adm1166_sim_bus *adm1166_sim_bus_new(const struct adm1166_bus_model *model)
+{
+	struct adm1166_sim_bus *bus;
+
+	bus = calloc(1, sizeof(*bus));
+	if (bus == NULL)
+		return NULL;
+	pthread_mutex_init(&bus->lock, NULL);
+	bus->model = *model;
+
+	return bus;
+}
+
+void adm1166_sim_bus_free(struct adm1166_sim_bus *bus)
+{
+	if (bus == NULL)
+		return;
+	pthread_mutex_destroy(&bus->lock);
+	free(bus);
+}
+
+/* The EEPROM erase and write cycles are left to the caller's delays */
+int adm1166_sim_attach(struct adm1166 *dev, struct adm1166_sim_bus *bus)
+{
+	struct adm1166_sim *sim = to_sim(dev);
+
+	if (sim == NULL)
+		return -ENODEV;
+
+	sim->bus = bus;
+
+	return 0;
+}
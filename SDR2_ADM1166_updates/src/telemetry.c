@@ -0,0 +1,476 @@
+/*
+ * Copyright (C) 2015-2016 Analog Devices, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * */
+
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "adm1166.h"
+#include "proto.h"
+
+static unsigned long long now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+int adm1166_sample_read(struct adm1166 *dev, struct adm1166_sample *s)
+{
+	return adm1166_sample_read_channels(dev,
+		(1 << ADM1166_ADC_CHANNELS) - 1, s);
+}
+
+/* One block read from the first to the last channel in mask */
+int adm1166_sample_read_channels(struct adm1166 *dev, unsigned int mask,
+	struct adm1166_sample *s)
+{
+	unsigned char buf[2 * ADM1166_ADC_CHANNELS];
+	unsigned int ch, first, last;
+	int ret;
+
+	s->t_us = now_us();
+
+	ret = adm1166_regs_read(dev, ADM1166_REG_PDOSTAT1, buf, 3);
+	if (ret < 0)
+		return ret;
+	s->pdo = buf[0] | (buf[1] << 8);
+	s->state = buf[2];
+
+	mask &= (1 << ADM1166_ADC_CHANNELS) - 1;
+	s->mask = mask;
+	memset(s->adc, 0x00, sizeof(s->adc));
+	if (mask == 0)
+		return 0;
+	for (first = 0; !(mask & (1 << first)); first++)
+		;
+	for (last = ADM1166_ADC_CHANNELS - 1; !(mask & (1 << last)); last--)
+		;
+
+	ret = adm1166_regs_read(dev, ADM1166_REG_ADC(first), buf,
+		2 * (last - first + 1));
+	if (ret < 0)
+		return ret;
+	for (ch = first; ch <= last; ch++)
+		s->adc[ch] = (buf[2 * (ch - first)] << 4) |
+			(buf[2 * (ch - first) + 1] & 0x0f);
+
+	return 0;
+}
+
+unsigned int adm1166_readback_cycle_us(unsigned int mask, int avg)
+{
+	unsigned int ch, n = 0;
+
+	for (ch = 0; ch < ADM1166_ADC_CHANNELS; ch++)
+		n += !!(mask & (1 << ch));
+
+	return n * ADM1166_RR_CONV_US * (avg ? ADM1166_RR_AVG : 1);
+}
+
+/* Channels 0-7 are deselected in RRSEL1, the rest in RRSEL2 */
+int adm1166_readback_setup(struct adm1166 *dev,
+	const struct adm1166_readback *rb)
+{
+	unsigned int off = ~rb->mask & ((1 << ADM1166_ADC_CHANNELS) - 1);
+	int ret;
+
+	/* Stop the round robin while the channel set changes */
+	ret = adm1166_reg_write(dev, ADM1166_REG_RRCTRL, 0);
+	if (ret == 0)
+		ret = adm1166_reg_write(dev, ADM1166_REG_RRSEL1, off & 0xff);
+	if (ret == 0)
+		ret = adm1166_reg_write(dev, ADM1166_REG_RRSEL2, off >> 8);
+	if (ret == 0)
+		ret = adm1166_reg_write(dev, ADM1166_REG_RRCTRL,
+			ADM1166_RRCTRL_ENABLE | ADM1166_RRCTRL_GO |
+			(rb->avg ? ADM1166_RRCTRL_AVG : 0));
+
+	return ret;
+}
+
+#define TUNE_READS	16
+
+static void sleep_us(unsigned int us)
+{
+	struct timespec ts = { us / 1000000, (us % 1000000) * 1000 };
+
+	nanosleep(&ts, NULL);
+}
+
+/*
+ * Measures the noise of the channels in mask without averaging, one read
+ * per round robin cycle, and turns averaging on when that is above the
+ * noise target (codes RMS, 0 for none) and the averaged cycle still fits
+ * into the sampling interval.  Averaging 16 conversions takes the noise
+ * down by 4.  Returns 1 when the target cannot be met at this interval,
+ * the engine is left set up without averaging then.
+ */
+int adm1166_readback_tune(struct adm1166 *dev, unsigned int mask, float noise,
+	unsigned int interval_us, struct adm1166_readback *rb)
+{
+	double sum[ADM1166_ADC_CHANNELS] = { 0 }, sq[ADM1166_ADC_CHANNELS] = { 0 };
+	struct adm1166_sample s;
+	unsigned int i, ch;
+	double var;
+	int ret;
+
+	memset(rb, 0x00, sizeof(*rb));
+	rb->mask = mask & ((1 << ADM1166_ADC_CHANNELS) - 1);
+	rb->cycle_us = adm1166_readback_cycle_us(rb->mask, 0);
+
+	ret = adm1166_readback_setup(dev, rb);
+	if (ret < 0 || noise <= 0 || rb->mask == 0)
+		return ret;
+
+	for (i = 0; i < TUNE_READS; i++) {
+		sleep_us(rb->cycle_us + rb->cycle_us / 8);
+		ret = adm1166_sample_read_channels(dev, rb->mask, &s);
+		if (ret < 0)
+			return ret;
+		for (ch = 0; ch < ADM1166_ADC_CHANNELS; ch++) {
+			sum[ch] += s.adc[ch];
+			sq[ch] += (double)s.adc[ch] * s.adc[ch];
+		}
+	}
+	for (ch = 0; ch < ADM1166_ADC_CHANNELS; ch++) {
+		if (!(rb->mask & (1 << ch)))
+			continue;
+		var = (sq[ch] - sum[ch] * sum[ch] / TUNE_READS) / (TUNE_READS - 1);
+		if (var > rb->noise * rb->noise)
+			rb->noise = sqrt(var);
+	}
+
+	if (rb->noise <= noise)
+		return 0;
+	if (adm1166_readback_cycle_us(rb->mask, 1) > interval_us)
+		return 1;
+
+	rb->avg = 1;
+	rb->cycle_us = adm1166_readback_cycle_us(rb->mask, 1);
+	ret = adm1166_readback_setup(dev, rb);
+	if (ret < 0)
+		return ret;
+
+	return rb->noise / 4 > noise;
+}
+
+void adm1166_sample_print_header(FILE *f)
+{
+	unsigned int ch;
+
+	fprintf(f, "# t_us state pdo");
+	for (ch = 0; ch < ADM1166_ADC_CHANNELS; ch++)
+		fprintf(f, " %s", adm1166_adc_channel_name(ch));
+	fprintf(f, "\n");
+}
+
+void adm1166_sample_print(FILE *f, const struct adm1166_sample *s)
+{
+	unsigned int ch;
+
+	fprintf(f, "%llu %u %03x", s->t_us, s->state, s->pdo);
+	for (ch = 0; ch < ADM1166_ADC_CHANNELS; ch++) {
+		if (s->mask & (1 << ch))
+			fprintf(f, " %u", s->adc[ch]);
+		else
+			fprintf(f, " -");
+	}
+	fprintf(f, "\n");
+}
+
+int adm1166_sample_parse(const char *line, struct adm1166_sample *s)
+{
+	unsigned int ch;
+	char *end;
+
+	s->t_us = strtoull(line, &end, 10);
+	if (end == line)
+		return -1;
+	line = end;
+	s->state = strtoul(line, &end, 10);
+	if (end == line)
+		return -1;
+	line = end;
+	s->pdo = strtoul(line, &end, 16);
+	if (end == line)
+		return -1;
+
+	s->mask = 0;
+	for (ch = 0; ch < ADM1166_ADC_CHANNELS; ch++) {
+		line = end;
+		while (*line == ' ')
+			line++;
+		if (*line == '-') {
+			end = (char *)line + 1;
+			continue;
+		}
+		s->adc[ch] = strtoul(line, &end, 10);
+		if (end == line)
+			return -1;
+		s->mask |= 1 << ch;
+	}
+
+	return 0;
+}
+
+/*
+ * A batch is the sample count followed by every sample as the zigzag
+ * varint difference to the previous one: time, state, PDOs, then the
+ * channel mask and the channels present.  Steady rails cost one byte per
+ * channel.
+ */
+int adm1166_samples_encode(struct proto_buf *b,
+	const struct adm1166_sample *s, unsigned int n)
+{
+	struct adm1166_sample prev;
+	unsigned int i, ch;
+	int ret;
+
+	memset(&prev, 0x00, sizeof(prev));
+
+	ret = proto_put_varint(b, n);
+	for (i = 0; i < n && ret == 0; i++) {
+		ret = proto_put_svarint(b, (long long)(s[i].t_us - prev.t_us));
+		if (ret == 0)
+			ret = proto_put_svarint(b, (long long)s[i].state -
+				prev.state);
+		if (ret == 0)
+			ret = proto_put_svarint(b, (long long)s[i].pdo - prev.pdo);
+		if (ret == 0)
+			ret = proto_put_varint(b, s[i].mask);
+		for (ch = 0; ch < ADM1166_ADC_CHANNELS && ret == 0; ch++) {
+			if (!(s[i].mask & (1 << ch)))
+				continue;
+			ret = proto_put_svarint(b, (int)s[i].adc[ch] - prev.adc[ch]);
+			prev.adc[ch] = s[i].adc[ch];
+		}
+		prev.t_us = s[i].t_us;
+		prev.state = s[i].state;
+		prev.pdo = s[i].pdo;
+	}
+
+	return ret;
+}
+
+int adm1166_samples_decode(const unsigned char *p, unsigned int len,
+	struct adm1166_sample *s, unsigned int max)
+{
+	const unsigned char *end = p + len;
+	struct adm1166_sample prev;
+	unsigned long long n, mask;
+	unsigned int i, ch;
+	long long d[3];
+
+	memset(&prev, 0x00, sizeof(prev));
+
+	if (proto_get_varint(&p, end, &n) < 0 || n > max)
+		return -EINVAL;
+
+	for (i = 0; i < n; i++) {
+		if (proto_get_svarint(&p, end, &d[0]) < 0 ||
+		    proto_get_svarint(&p, end, &d[1]) < 0 ||
+		    proto_get_svarint(&p, end, &d[2]) < 0 ||
+		    proto_get_varint(&p, end, &mask) < 0)
+			return -EINVAL;
+		s[i].t_us = prev.t_us + d[0];
+		s[i].state = prev.state + d[1];
+		s[i].pdo = prev.pdo + d[2];
+		s[i].mask = mask & ((1 << ADM1166_ADC_CHANNELS) - 1);
+		for (ch = 0; ch < ADM1166_ADC_CHANNELS; ch++) {
+			if (!(s[i].mask & (1 << ch)))
+				continue;
+			if (proto_get_svarint(&p, end, &d[0]) < 0)
+				return -EINVAL;
+			prev.adc[ch] += d[0];
+			s[i].adc[ch] = prev.adc[ch];
+		}
+		prev.t_us = s[i].t_us;
+		prev.state = s[i].state;
+		prev.pdo = s[i].pdo;
+	}
+
+	return n;
+}
+
+int adm1166_event_encode(struct proto_buf *b, const struct adm1166_event *ev)
+{
+	int ret;
+
+	ret = proto_put_varint(b, ev->t_us);
+	if (ret == 0)
+		ret = proto_put_varint(b, ev->from);
+	if (ret == 0)
+		ret = proto_put_varint(b, ev->to);
+	if (ret == 0)
+		ret = proto_put_varint(b, ev->pdo);
+
+	return ret;
+}
+
+int adm1166_event_decode(const unsigned char *p, unsigned int len,
+	struct adm1166_event *ev)
+{
+	const unsigned char *end = p + len;
+	unsigned long long v[4];
+	unsigned int i;
+
+	for (i = 0; i < 4; i++) {
+		if (proto_get_varint(&p, end, &v[i]) < 0)
+			return -EINVAL;
+	}
+	ev->t_us = v[0];
+	ev->from = v[1];
+	ev->to = v[2];
+	ev->pdo = v[3];
+
+	return 0;
+}
+
+/*
+ * Steady state is the state the board sits in at the end of the capture,
+ * the ramps are measured against the mean level in that state.  When every
+ * steady sample carries the temperature and it spans at least 1 C of
+ * standard deviation, each channel is regressed against it.
+ */
+void adm1166_signature_compute(const struct adm1166_sample *s,
+	unsigned int n, struct adm1166_signature *sig)
+{
+	double sum[ADM1166_ADC_CHANNELS], sq[ADM1166_ADC_CHANNELS];
+	double st[ADM1166_ADC_CHANNELS], stt[ADM1166_ADC_CHANNELS];
+	double sty[ADM1166_ADC_CHANNELS];
+	double dwell[ADM1166_SE_STATES];
+	unsigned int cnt[ADM1166_ADC_CHANNELS], tcnt[ADM1166_ADC_CHANNELS];
+	unsigned int visits[ADM1166_SE_STATES];
+	unsigned long long t10, entered;
+	unsigned int i, ch, steady, level, phase;
+	double mean, var, t, mt, vt, cov, slope, y;
+
+	for (i = 0; i < ADM1166_SIG_FEATURES; i++)
+		sig->f[i] = NAN;
+	if (n == 0)
+		return;
+
+	memset(sum, 0x00, sizeof(sum));
+	memset(sq, 0x00, sizeof(sq));
+	memset(st, 0x00, sizeof(st));
+	memset(stt, 0x00, sizeof(stt));
+	memset(sty, 0x00, sizeof(sty));
+	memset(cnt, 0x00, sizeof(cnt));
+	memset(tcnt, 0x00, sizeof(tcnt));
+	memset(dwell, 0x00, sizeof(dwell));
+	memset(visits, 0x00, sizeof(visits));
+
+	steady = s[n - 1].state;
+	for (i = 0; i < n; i++) {
+		if (s[i].state != steady)
+			continue;
+		t = ADM1166_TEMP_MC(s[i].adc[ADM1166_ADC_TEMP]) / 1000.0;
+		for (ch = 0; ch < ADM1166_ADC_CHANNELS; ch++) {
+			if (!(s[i].mask & (1 << ch)))
+				continue;
+			y = s[i].adc[ch];
+			sum[ch] += y;
+			sq[ch] += y * y;
+			cnt[ch]++;
+			if (!(s[i].mask & (1 << ADM1166_ADC_TEMP)))
+				continue;
+			st[ch] += t;
+			stt[ch] += t * t;
+			sty[ch] += t * y;
+			tcnt[ch]++;
+		}
+	}
+
+	for (ch = 0; ch < ADM1166_ADC_CHANNELS; ch++) {
+		if (cnt[ch] == 0)
+			continue;
+		mean = sum[ch] / cnt[ch];
+		var = sq[ch] / cnt[ch] - mean * mean;
+
+		if (ch != ADM1166_ADC_TEMP && tcnt[ch] == cnt[ch]) {
+			mt = st[ch] / cnt[ch];
+			vt = stt[ch] / cnt[ch] - mt * mt;
+			cov = sty[ch] / cnt[ch] - mt * mean;
+			if (vt >= 1.0) {
+				slope = cov / vt;
+				sig->f[ADM1166_SIG_TEMPCO(ch)] = slope;
+				sig->f[ADM1166_SIG_MEAN(ch)] = mean + slope * (25.0 - mt);
+				var -= slope * cov;
+			}
+		}
+		if (isnan(sig->f[ADM1166_SIG_MEAN(ch)]))
+			sig->f[ADM1166_SIG_MEAN(ch)] = mean;
+		sig->f[ADM1166_SIG_NOISE(ch)] = var > 0 ? sqrt(var) : 0;
+
+		/* Only a capture that starts below 10% has seen the ramp */
+		phase = 0;
+		t10 = 0;
+		for (i = 0; i < n; i++) {
+			if (!(s[i].mask & (1 << ch)))
+				continue;
+			level = s[i].adc[ch];
+			if (phase == 0 && level < 0.1 * mean) {
+				phase = 1;
+			} else if (phase == 1 && level >= 0.1 * mean) {
+				t10 = s[i].t_us;
+				phase = 2;
+			}
+			if (phase == 2 && level >= 0.9 * mean) {
+				sig->f[ADM1166_SIG_RAMP(ch)] = (s[i].t_us - t10) / 1000.0;
+				break;
+			}
+		}
+	}
+
+	/* Only complete visits count, the first and last state are cut off */
+	entered = 0;
+	for (i = 1; i < n; i++) {
+		if (s[i].state == s[i - 1].state)
+			continue;
+		if (entered && s[i - 1].state < ADM1166_SE_STATES) {
+			dwell[s[i - 1].state] += s[i].t_us - entered;
+			visits[s[i - 1].state]++;
+		}
+		entered = s[i].t_us;
+	}
+
+	for (i = 0; i < ADM1166_SE_STATES; i++) {
+		if (visits[i])
+			sig->f[ADM1166_SIG_DWELL(i)] = dwell[i] / visits[i] / 1000.0;
+	}
+}
+
+void adm1166_signature_feature_name(unsigned int i, char *buf,
+	unsigned int len)
+{
+	if (i < ADM1166_SIG_NOISE(0))
+		snprintf(buf, len, "%s.mean", adm1166_adc_channel_name(i));
+	else if (i < ADM1166_SIG_RAMP(0))
+		snprintf(buf, len, "%s.noise",
+			adm1166_adc_channel_name(i - ADM1166_SIG_NOISE(0)));
+	else if (i < ADM1166_SIG_TEMPCO(0))
+		snprintf(buf, len, "%s.ramp_ms",
+			adm1166_adc_channel_name(i - ADM1166_SIG_RAMP(0)));
+	else if (i < ADM1166_SIG_DWELL(0))
+		snprintf(buf, len, "%s.tempco",
+			adm1166_adc_channel_name(i - ADM1166_SIG_TEMPCO(0)));
+	else
+		snprintf(buf, len, "state%u.dwell_ms", i - ADM1166_SIG_DWELL(0));
+}